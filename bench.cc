@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <malloc.h>
+
+#include "budget.h"
+#include "lambda.h"
+#include "parser.h"
+#include "region.h"
+#include "source.h"
+
+using std::atomic;
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::memory_order_relaxed;
+using std::pair;
+using std::runtime_error;
+using std::string;
+using std::to_string;
+using std::vector;
+using std::chrono::duration;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+using Lambda::Budget;
+using Lambda::BudgetExceeded;
+using Lambda::BudgetScope;
+using Lambda::Engine;
+using Lambda::ExpressionP;
+using Lambda::Limits;
+using Lambda::Region;
+using Lambda::RegionScope;
+using Lambda::SourceFile;
+using Lambda::SourceLines;
+using Lambda::reduce;
+using Lambda::Parser::ExpressionBuilder;
+using Lambda::Parser::SymbolTableP;
+using Lambda::Parser::newDefaultSymTable;
+
+// Every allocation from the heap is counted, along with the bytes in use and
+// the most that have been in use since the last reset
+namespace {
+
+atomic<unsigned long> g_allocations(0);
+atomic<size_t> g_heap(0);
+atomic<size_t> g_peak(0);
+
+void *counted(void *p)
+{
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	g_allocations.fetch_add(1, memory_order_relaxed);
+	auto heap = g_heap.fetch_add(malloc_usable_size(p), memory_order_relaxed) + malloc_usable_size(p);
+	auto peak = g_peak.load(memory_order_relaxed);
+	while (heap > peak && !g_peak.compare_exchange_weak(peak, heap, memory_order_relaxed)) {}
+	return p;
+}
+
+void uncounted(void *p)
+{
+	if (p) {
+		g_heap.fetch_sub(malloc_usable_size(p), memory_order_relaxed);
+		std::free(p);
+	}
+}
+
+} // namespace
+
+void *operator new(size_t size)
+{
+	return counted(std::malloc(size ? size : 1));
+}
+
+void *operator new[](size_t size)
+{
+	return counted(std::malloc(size ? size : 1));
+}
+
+void operator delete(void *p) noexcept
+{
+	uncounted(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	uncounted(p);
+}
+
+namespace {
+
+const vector<pair<string, Engine>> &engines()
+{
+	const static vector<pair<string, Engine>> names = {
+		{"krivine", Engine::KRIVINE},
+		{"lazy", Engine::LAZY},
+		{"nbe", Engine::NBE},
+		{"vm", Engine::VM},
+		{"optimal", Engine::OPTIMAL},
+		{"zipper", Engine::ZIPPER},
+		{"normal", Engine::NORMAL},
+		{"applicative", Engine::APPLICATIVE},
+		{"parallel", Engine::PARALLEL}
+	};
+
+	return names;
+}
+
+// A line of stdlib.l to evaluate, at sizes growing until an engine runs out
+// of time on one. A series without sizes is evaluated once, as it is.
+struct Series
+{
+	string name;
+	string source;
+	vector<unsigned long> sizes;
+};
+
+const vector<Series> &suite()
+{
+	const static vector<Series> series = {
+		{"factorial", "factorial N", {2, 4, 6, 8, 10}},
+		{"power", "power 2 N", {2, 4, 8, 12, 16}},
+		{"div", "div N 3", {10, 100, 1000, 10000}},
+		{"mod", "mod N 7", {10, 100, 1000, 10000}},
+		{"equal", "equal N N", {10, 100, 1000, 10000}},
+		{"AND", "AND TRUE FALSE", {}},
+		{"NOT", "NOT TRUE", {}}
+	};
+
+	return series;
+}
+
+string instantiate(const string &source, unsigned long size)
+{
+	string line;
+	for (auto c: source) {
+		if (c == 'N') {
+			line += to_string(size);
+		} else {
+			line += c;
+		}
+	}
+	return line;
+}
+
+// Adds the definitions in file to syms, read the way lambda reads them
+void load(const string &file, SymbolTableP syms)
+{
+	SourceFile source(file);
+	SourceLines lines(source.begin(), source.end());
+	const char *begin;
+	const char *end;
+	while (lines.next(begin, end)) {
+		ExpressionBuilder eb(begin, end, syms);
+		for (auto p = eb.parse1(); p.second; p = eb.parse1()) {}
+	}
+}
+
+ExpressionP parse(const string &line, SymbolTableP syms)
+{
+	ExpressionBuilder eb(line, syms);
+	auto p = eb.parse1();
+	if (!p.first.empty() || !p.second) {
+		throw runtime_error("Not an expression: \"" + line + "\"");
+	}
+	return p.second;
+}
+
+struct Run
+{
+	bool finished;
+	unsigned long steps;
+	double seconds;
+	// Heap allocations and the most heap in use above what was before the
+	// run started, region chunks included
+	unsigned long allocations;
+	size_t peak_bytes;
+	// Blocks allocated in the region of the evaluation, and the most bytes
+	// they took up at once
+	size_t region_allocations;
+	size_t region_peak_bytes;
+};
+
+Run measure(const ExpressionP &expr, Engine engine, const Limits &limits)
+{
+	Run run{true, 0, 0, 0, 0, 0, 0};
+	auto allocations = g_allocations.load();
+	auto heap = g_heap.load();
+	g_peak.store(heap);
+
+	{
+		RegionScope scope;
+		Budget budget(limits);
+		auto start = steady_clock::now();
+		{
+			BudgetScope in_force(&budget);
+			try {
+				reduce(expr, engine);
+			} catch (const BudgetExceeded &) {
+				run.finished = false;
+			}
+		}
+		run.seconds = duration<double>(steady_clock::now() - start).count();
+		run.steps = budget.progress().steps;
+		run.region_allocations = Region::current()->allocations();
+		run.region_peak_bytes = Region::current()->peak();
+	}
+
+	run.allocations = g_allocations.load() - allocations;
+	run.peak_bytes = g_peak.load() - heap;
+	return run;
+}
+
+// One line of output, the best of as many runs as fit in min_time
+void report(const string &series, const string &line, const unsigned long *size, const string &engine, const Run &first, double best, unsigned runs)
+{
+	cout << "{\"series\":\"" << series << "\",\"expression\":\"" << line << "\"";
+	if (size) {
+		cout << ",\"size\":" << *size;
+	}
+	cout << ",\"engine\":\"" << engine << "\",\"status\":\"" << (first.finished ? "ok" : "timeout") << "\"";
+	cout << ",\"runs\":" << runs << ",\"steps\":" << first.steps << ",\"seconds\":" << best;
+	if (first.finished && first.steps && best > 0) {
+		cout << ",\"steps_per_sec\":" << first.steps / best << ",\"ns_per_step\":" << best * 1e9 / first.steps;
+	}
+	cout << ",\"allocations\":" << first.allocations << ",\"peak_bytes\":" << first.peak_bytes;
+	cout << ",\"region_allocations\":" << first.region_allocations << ",\"region_peak_bytes\":" << first.region_peak_bytes;
+	cout << "}" << endl;
+}
+
+} // namespace
+
+// Prints one JSON object per line for every expression of the suite and every
+// engine: the steps it took in the unit of the engine, the time of the best
+// run, and the allocations and peak heap use of the first
+int main(int argc, char *argv[])
+{
+	vector<pair<string, Engine>> chosen;
+	string only;
+	auto timeout = milliseconds(1000);
+	auto min_time = 0.2;
+	vector<string> files;
+
+	for (int i = 1; i < argc; ++i) {
+		string arg{argv[i]};
+		if (arg.compare(0, 9, "--engine=") == 0) {
+			auto found = false;
+			for (auto &engine: engines()) {
+				if (engine.first == arg.substr(9)) {
+					chosen.push_back(engine);
+					found = true;
+				}
+			}
+			if (!found) {
+				cerr << "Unknown engine \"" << arg.substr(9) << "\"" << endl;
+				return 1;
+			}
+		} else if (arg.compare(0, 9, "--series=") == 0) {
+			only = arg.substr(9);
+		} else if (arg.compare(0, 10, "--timeout=") == 0) {
+			timeout = milliseconds(std::strtoul(arg.c_str() + 10, nullptr, 10));
+		} else if (arg.compare(0, 11, "--min-time=") == 0) {
+			min_time = std::strtoul(arg.c_str() + 11, nullptr, 10) / 1000.0;
+		} else if (arg.compare(0, 2, "--") == 0) {
+			cerr << "Unknown option \"" << arg << "\"" << endl;
+			return 1;
+		} else {
+			files.push_back(arg);
+		}
+	}
+
+	if (files.empty()) {
+		cerr << "Usage: lambda-bench [--engine=NAME]... [--series=NAME] [--timeout=MS] [--min-time=MS] stdlib.l..." << endl;
+		return 1;
+	}
+	if (chosen.empty()) {
+		chosen = engines();
+	}
+
+	auto syms = newDefaultSymTable();
+	try {
+		for (auto &file: files) {
+			load(file, syms);
+		}
+	} catch (const runtime_error &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+
+	Limits limits{};
+	limits.time = timeout;
+
+	for (auto &series: suite()) {
+		if (!only.empty() && series.name != only) {
+			continue;
+		}
+
+		for (auto &engine: chosen) {
+			auto sizes = series.sizes;
+			if (sizes.empty()) {
+				sizes.push_back(0);
+			}
+
+			for (auto &size: sizes) {
+				auto line = series.sizes.empty() ? series.source : instantiate(series.source, size);
+				auto expr = parse(line, syms);
+
+				auto first = measure(expr, engine.second, limits);
+				auto best = first.seconds;
+				unsigned runs = 1;
+				for (auto total = first.seconds; first.finished && total < min_time && runs < 1000; ++runs) {
+					auto again = measure(expr, engine.second, limits);
+					total += again.seconds;
+					best = std::min(best, again.seconds);
+				}
+
+				report(series.name, line, series.sizes.empty() ? nullptr : &size, engine.first, first, best, runs);
+				if (!first.finished) {
+					// The larger sizes would only take longer
+					break;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
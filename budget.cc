@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <sstream>
+
+#include "budget.h"
+#include "region.h"
+
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::memory_order_relaxed;
+using std::min;
+using std::ostringstream;
+using std::string;
+
+namespace Lambda {
+
+namespace {
+
+// Steps between looks at the budget in force
+const unsigned CHECK_INTERVAL = 256;
+
+thread_local Budget *t_budget = nullptr;
+
+// Steps taken on this thread since the budget was last looked at, and how
+// many more to take before looking again
+thread_local unsigned t_ticks = 0;
+thread_local unsigned t_interval = CHECK_INTERVAL;
+
+const char *describe(BudgetExceeded::Limit limit)
+{
+	switch (limit) {
+	case BudgetExceeded::Limit::STEPS:
+		return "Out of steps";
+	case BudgetExceeded::Limit::NODES:
+		return "Out of nodes";
+	case BudgetExceeded::Limit::BYTES:
+		return "Out of memory";
+	case BudgetExceeded::Limit::TIME:
+		return "Out of time";
+	case BudgetExceeded::Limit::CANCELLED:
+		return "Cancelled";
+	}
+	return "Stopped";
+}
+
+string message(BudgetExceeded::Limit limit, const Progress &progress)
+{
+	ostringstream os;
+	os << describe(limit) << " after " << progress.steps << " steps, "
+		<< progress.nodes << " live nodes, " << progress.bytes << " bytes, "
+		<< progress.elapsed.count() << " ms";
+	return os.str();
+}
+
+} // namespace
+
+BudgetExceeded::BudgetExceeded(Limit limit, const Progress &progress):
+	std::runtime_error(message(limit, progress)),
+	m_limit(limit),
+	m_progress(progress)
+{
+}
+
+Budget::Budget(const Limits &limits, const CancelToken *token):
+	m_limits(limits),
+	m_token(token),
+	m_region(Region::current()),
+	m_start(steady_clock::now()),
+	m_steps(0)
+{
+}
+
+void Budget::step()
+{
+	if (++t_ticks < t_interval) {
+		return;
+	}
+
+	auto ticks = t_ticks;
+	t_ticks = 0;
+	if (t_budget) {
+		t_budget->check(ticks);
+	}
+}
+
+Budget *Budget::current()
+{
+	return t_budget;
+}
+
+Progress Budget::progress() const
+{
+	Progress progress{m_steps.load(memory_order_relaxed), 0, 0,
+		duration_cast<milliseconds>(steady_clock::now() - m_start)};
+	if (m_region) {
+		progress.nodes = m_region->live();
+		progress.bytes = m_region->bytes();
+	}
+	return progress;
+}
+
+void Budget::check(unsigned steps)
+{
+	auto total = m_steps.fetch_add(steps, memory_order_relaxed) + steps;
+
+	using Limit = BudgetExceeded::Limit;
+	if (m_token && m_token->cancelled()) {
+		throw BudgetExceeded(Limit::CANCELLED, progress());
+	}
+	if (m_limits.steps) {
+		if (total > m_limits.steps) {
+			// The step that would go over is not taken
+			m_steps.fetch_sub(1, memory_order_relaxed);
+			throw BudgetExceeded(Limit::STEPS, progress());
+		}
+		// Look again right past the limit, if this is the only thread taking
+		// steps
+		t_interval = min<unsigned long>(CHECK_INTERVAL, m_limits.steps - total + 1);
+	}
+	if (m_limits.time.count() && steady_clock::now() - m_start >= m_limits.time) {
+		throw BudgetExceeded(Limit::TIME, progress());
+	}
+	if (m_region) {
+		if (m_limits.nodes && m_region->live() > m_limits.nodes) {
+			throw BudgetExceeded(Limit::NODES, progress());
+		}
+		if (m_limits.bytes && m_region->bytes() > m_limits.bytes) {
+			throw BudgetExceeded(Limit::BYTES, progress());
+		}
+	}
+}
+
+BudgetScope::BudgetScope(Budget *budget):
+	m_previous(t_budget),
+	m_pending(t_ticks)
+{
+	t_budget = budget;
+	t_ticks = 0;
+	t_interval = CHECK_INTERVAL;
+	if (budget && budget->m_limits.steps) {
+		t_interval = min<unsigned long>(CHECK_INTERVAL, budget->m_limits.steps + 1);
+	}
+}
+
+BudgetScope::~BudgetScope()
+{
+	// Steps taken since the last look still count, but there is no throwing
+	// from here
+	if (t_budget) {
+		t_budget->m_steps.fetch_add(t_ticks, memory_order_relaxed);
+	}
+	t_budget = m_previous;
+	t_ticks = m_pending;
+	t_interval = CHECK_INTERVAL;
+}
+
+} // namespace Lambda
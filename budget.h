@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <stdexcept>
+
+namespace Lambda {
+
+class Region;
+
+// What one evaluation may use, zero standing for no limit
+struct Limits
+{
+	// Reduction steps, counted by each engine in its own unit: a beta or
+	// delta step, a machine transition or an interaction
+	unsigned long steps;
+	// Blocks and bytes live in the region of the evaluation
+	size_t nodes;
+	size_t bytes;
+	std::chrono::milliseconds time;
+};
+
+// How far an evaluation had got
+struct Progress
+{
+	unsigned long steps;
+	size_t nodes;
+	size_t bytes;
+	std::chrono::milliseconds elapsed;
+};
+
+// Set from any thread to stop the evaluations whose budget holds it
+class CancelToken
+{
+public:
+	CancelToken():
+		m_cancelled(false) {}
+
+	CancelToken(const CancelToken &) = delete;
+	CancelToken &operator=(const CancelToken &) = delete;
+
+	// Safe to call from a signal handler
+	void cancel()
+	{
+		m_cancelled.store(true, std::memory_order_relaxed);
+	}
+
+	bool cancelled() const
+	{
+		return m_cancelled.load(std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<bool> m_cancelled;
+};
+
+// Thrown out of a reducer whose evaluation has used up its budget or been
+// cancelled
+class BudgetExceeded: public std::runtime_error
+{
+public:
+	enum class Limit {
+		STEPS,
+		NODES,
+		BYTES,
+		TIME,
+		CANCELLED
+	};
+
+	BudgetExceeded(Limit limit, const Progress &progress);
+
+	Limit limit() const
+	{
+		return m_limit;
+	}
+
+	const Progress &progress() const
+	{
+		return m_progress;
+	}
+
+private:
+	const Limit m_limit;
+	const Progress m_progress;
+};
+
+// The limits on one evaluation and what it has used of them. Reducers call
+// step() for every step they take, which costs a thread-local increment; the
+// budget in force on the thread is only looked at every so often, when its
+// steps are added up and the clock, the region and the token are checked. It
+// may be shared by the threads working on one evaluation.
+class Budget
+{
+public:
+	// Memory is measured in the region nodes are created in on this thread
+	// when the budget is made
+	explicit Budget(const Limits &limits, const CancelToken *token = nullptr);
+
+	Budget(const Budget &) = delete;
+	Budget &operator=(const Budget &) = delete;
+
+	static void step();
+
+	// The budget in force on this thread, if any
+	static Budget *current();
+
+	Progress progress() const;
+
+private:
+	friend class BudgetScope;
+
+	// Adds steps not yet counted, throwing BudgetExceeded if a limit has been
+	// reached
+	void check(unsigned steps);
+
+	const Limits m_limits;
+	const CancelToken *const m_token;
+	Region *const m_region;
+	const std::chrono::steady_clock::time_point m_start;
+	std::atomic<unsigned long> m_steps;
+};
+
+// Puts budget in force on this thread for the lifetime of the scope, none if
+// it is null
+class BudgetScope
+{
+public:
+	explicit BudgetScope(Budget *budget);
+	~BudgetScope();
+
+	BudgetScope(const BudgetScope &) = delete;
+	BudgetScope &operator=(const BudgetScope &) = delete;
+
+private:
+	Budget *m_previous;
+	unsigned m_pending;
+};
+
+} // namespace Lambda
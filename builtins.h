@@ -0,0 +1,204 @@
+#pragma once
+
+#include "lambda.h"
+#include "term.h"
+
+namespace Lambda {
+namespace Expressions {
+
+// The builtins are compiled into read-only tables and each is built the first
+// time it is used, so none of them costs anything at startup. The types can be
+// used inside other terms, the constants anywhere an ExpressionP is expected.
+
+namespace Variables {
+
+LAMBDA_VARIABLE(x);
+LAMBDA_VARIABLE(y);
+LAMBDA_VARIABLE(e1);
+LAMBDA_VARIABLE(e2);
+LAMBDA_VARIABLE(c);
+LAMBDA_VARIABLE(n);
+LAMBDA_VARIABLE(s);
+LAMBDA_VARIABLE(f);
+LAMBDA_VARIABLE(obj);
+LAMBDA_VARIABLE(t);
+LAMBDA_VARIABLE(E1);
+LAMBDA_VARIABLE(E2);
+LAMBDA_VARIABLE(C);
+
+} // namespace Variables
+
+using namespace Variables;
+using Terms::App;
+using Terms::Lam;
+using Terms::Num;
+using Terms::Prim;
+using Terms::Term;
+
+using Op = Primitive::Op;
+
+// The numeral λx.x
+using Zero = Num<0>;
+
+// λx.λy.x
+using SelectFirst = Lam<x, y, x>;
+
+// λx.λy.y
+using SelectSecond = Lam<x, y, y>;
+
+using True = SelectFirst;
+using False = SelectSecond;
+
+// λe1.λe2.λc.((c e1) e2)
+using Cond = Lam<e1, e2, c, App<c, e1, e2>>;
+
+using MakePair = Cond;
+
+using IsZero = Prim<Op::ISZERO>;
+using Succ = Prim<Op::SUCC>;
+using Pred = Prim<Op::PRED>;
+using Add = Prim<Op::ADD>;
+using Sub = Prim<Op::SUB>;
+using Mult = Prim<Op::MULT>;
+using Equal = Prim<Op::EQUAL>;
+
+// λs.((s false) zero)
+using One = Num<1>;
+
+// λs.(f (s s)
+using Rec1 = Lam<s, App<f, App<s, s>>>;
+
+// λf.(λs.(f (s s)) λs.(f (s s)))
+using Recursive = Lam<f, App<Rec1, Rec1>>;
+
+// What the numerals and primitives stand for
+
+// λx.x
+using ZeroLambda = Lam<x, x>;
+
+// λn.(n select_first)
+using IsZeroLambda = Lam<n, App<n, SelectFirst>>;
+
+// λn.λs.((s false) n)
+using SuccLambda = Lam<n, s, App<s, False, n>>;
+
+// λn.if iszero n then zero else (n select_second)
+using PredLambda = Lam<n, App<Cond, Zero, App<n, SelectSecond>, App<IsZero, n>>>;
+
+// λf.λx.λy.if iszero x then y else ((f pred x) succ y)
+using Add1 =
+	Lam<f, x, y,
+		App<Cond,
+			// then
+			y,
+			// else
+			App<f, App<Pred, x>, App<Succ, y>>,
+			// cond
+			App<IsZero, x>
+		>
+	>;
+
+// (recursive add1)
+using AddLambda = App<Recursive, Add1>;
+
+// λf.λx.λy.if iszero y then x else ((f pred x) pred y)
+using Sub1 =
+	Lam<f, x, y,
+		App<Cond,
+			// then
+			x,
+			// else
+			App<f, App<Pred, x>, App<Pred, y>>,
+			// cond
+			App<IsZero, y>
+		>
+	>;
+
+// (recursive sub1)
+using SubLambda = App<Recursive, Sub1>;
+
+// λf.λx.λy.if iszero y then zero else add x (f x pred y)
+using Mult1 =
+	Lam<f, x, y,
+		App<Cond,
+			// then
+			Zero,
+			// else
+			App<Add, x, App<f, x, App<Pred, y>>>,
+			// cond
+			App<IsZero, y>
+		>
+	>;
+
+// (recursive mult1)
+using MultLambda = App<Recursive, Mult1>;
+
+// λx.λy.add sub x y sub y x
+using AbsDiff = Lam<x, y, App<Add, App<Sub, x, y>, App<Sub, y, x>>>;
+
+using EqualLambda = Lam<x, y, App<IsZero, App<AbsDiff, x, y>>>;
+
+using MakeObj = MakePair;
+
+using Type = Lam<obj, App<obj, SelectFirst>>;
+
+using Value = Lam<obj, App<obj, SelectSecond>>;
+
+using IsType = Lam<t, obj, App<Equal, t, App<Type, obj>>>;
+
+using ErrorType = Zero;
+
+using MakeError = App<MakeObj, ErrorType>;
+
+using BoolType = One;
+
+using IsBool = Lam<x, App<IsType, BoolType, x>>;
+
+using BoolError = App<MakeError, BoolType>;
+
+using TypedCond =
+	Lam<E1, E2, C,
+		App<Cond,
+			// then
+			App<Cond, E1, E2, App<Value, C>>,
+			// else
+			BoolError,
+			// cond
+			App<IsBool, C>
+		>
+	>;
+
+constexpr Term<Zero> zero{};
+constexpr Term<SelectFirst> select_first{};
+constexpr Term<SelectSecond> select_second{};
+constexpr Term<True> true_func{};
+constexpr Term<False> false_func{};
+constexpr Term<Cond> cond{};
+constexpr Term<MakePair> make_pair{};
+constexpr Term<IsZero> iszero{};
+constexpr Term<Succ> succ{};
+constexpr Term<One> one{};
+constexpr Term<Pred> pred{};
+constexpr Term<Rec1> rec1{};
+constexpr Term<Recursive> recursive{};
+constexpr Term<Add1> add1{};
+constexpr Term<Add> add{};
+constexpr Term<Sub1> sub1{};
+constexpr Term<Sub> sub{};
+constexpr Term<Mult1> mult1{};
+constexpr Term<Mult> mult{};
+constexpr Term<AbsDiff> abs_diff{};
+constexpr Term<Equal> equal{};
+constexpr Term<MakeObj> make_obj{};
+constexpr Term<Type> type_func{};
+constexpr Term<Value> value_func{};
+constexpr Term<IsType> istype{};
+constexpr Term<ErrorType> error_type{};
+constexpr Term<MakeError> make_error{};
+constexpr Term<BoolType> bool_type{};
+constexpr Term<IsBool> isbool{};
+constexpr Term<BoolError> bool_error{};
+constexpr Term<TypedCond> typed_cond{};
+
+} // namespace Expressions
+} // namespace Lambda
@@ -0,0 +1,35 @@
+#include <atomic>
+
+#include "concurrent.h"
+
+using std::atomic;
+using std::memory_order_relaxed;
+
+namespace Lambda {
+
+namespace {
+
+// Nested scopes, from one thread or from tasks it started
+atomic<unsigned> g_scopes{0};
+
+} // namespace
+
+// The threads a scope is for are started after it is created and joined
+// before it is destroyed, which orders their view of the count, so a relaxed
+// load is enough
+bool concurrent()
+{
+	return g_scopes.load(memory_order_relaxed) != 0;
+}
+
+ConcurrentScope::ConcurrentScope()
+{
+	++g_scopes;
+}
+
+ConcurrentScope::~ConcurrentScope()
+{
+	--g_scopes;
+}
+
+} // namespace Lambda
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <mutex>
+
+namespace Lambda {
+
+// Whether expressions, symbols and regions may be used from several threads
+// at the moment. The tables behind them only lock while this holds, so a
+// single threaded evaluation pays nothing for the locks.
+bool concurrent();
+
+// Makes concurrent() hold for the lifetime of the scope. It must be created
+// before other threads start on the shared tables and destroyed once they have
+// stopped.
+class ConcurrentScope
+{
+public:
+	ConcurrentScope();
+	~ConcurrentScope();
+
+	ConcurrentScope(const ConcurrentScope &) = delete;
+	ConcurrentScope &operator=(const ConcurrentScope &) = delete;
+};
+
+// Holds mutex for the lifetime of the lock if concurrent() holds when it is
+// created
+class ConcurrentLock
+{
+public:
+	explicit ConcurrentLock(std::mutex &mutex):
+		m_mutex(concurrent() ? &mutex : nullptr)
+	{
+		if (m_mutex) {
+			m_mutex->lock();
+		}
+	}
+
+	~ConcurrentLock()
+	{
+		if (m_mutex) {
+			m_mutex->unlock();
+		}
+	}
+
+	ConcurrentLock(const ConcurrentLock &) = delete;
+	ConcurrentLock &operator=(const ConcurrentLock &) = delete;
+
+private:
+	std::mutex *m_mutex;
+};
+
+} // namespace Lambda
@@ -0,0 +1,342 @@
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "image.h"
+#include "region.h"
+
+using std::make_shared;
+using std::memcmp;
+using std::memcpy;
+using std::ofstream;
+using std::runtime_error;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+namespace Lambda {
+namespace Image {
+
+namespace {
+
+const char MAGIC[8] = {'L', 'A', 'M', 'B', 'D', 'A', 'I', 'M'};
+const uint32_t VERSION = 2;
+
+// The file is a Header followed by the Entry, Node and Text arrays, and then
+// the characters of the names
+struct Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t entries;
+	uint32_t nodes;
+	uint32_t texts;
+	uint32_t chars;
+	uint32_t unused;
+};
+
+struct Entry
+{
+	uint64_t arity;
+	// Text of the key
+	uint32_t key;
+	// Node of the expression
+	uint32_t node;
+};
+
+struct Node
+{
+	enum Kind: uint32_t {
+		NAME,
+		INDEX,
+		FUNCTION,
+		APPLICATION,
+		NUMERAL,
+		PRIMITIVE
+	};
+
+	Kind kind;
+	// NAME: text, INDEX: index, FUNCTION: vbound node, APPLICATION: func node,
+	// NUMERAL: low half of the value, PRIMITIVE: op
+	uint32_t first;
+	// FUNCTION: body node, APPLICATION: arg node, NUMERAL: high half
+	uint32_t second;
+};
+
+struct Text
+{
+	uint32_t offset;
+	uint32_t size;
+};
+
+class Writer
+{
+public:
+	void add(const string &key, const ExpressionP &expr, size_t arity)
+	{
+		m_entries.push_back(Entry{arity, text(key), node(expr)});
+	}
+
+	void write(const string &path) const;
+
+private:
+	uint32_t text(const string &str);
+	uint32_t node(const ExpressionP &expr);
+
+	vector<Entry> m_entries;
+	vector<Node> m_nodes;
+	vector<Text> m_texts;
+	string m_chars;
+
+	unordered_map<const Expression *, uint32_t> m_node_ids;
+	unordered_map<string, uint32_t> m_text_ids;
+};
+
+uint32_t Writer::text(const string &str)
+{
+	auto it = m_text_ids.find(str);
+	if (it != m_text_ids.end()) {
+		return it->second;
+	}
+
+	m_texts.push_back(Text{static_cast<uint32_t>(m_chars.size()), static_cast<uint32_t>(str.size())});
+	m_chars += str;
+	m_text_ids.emplace(str, m_texts.size() - 1);
+	return m_texts.size() - 1;
+}
+
+// Children are numbered before their parents. The walk keeps its own stack,
+// since the terms can be deeper than the call stack allows.
+uint32_t Writer::node(const ExpressionP &root)
+{
+	vector<ExpressionP> stack{root};
+	while (!stack.empty()) {
+		auto expr = stack.back();
+		if (m_node_ids.count(expr.get())) {
+			stack.pop_back();
+			continue;
+		}
+
+		vector<ExpressionP> children;
+		if (auto func = dynamic_cast<const Function *>(expr.get())) {
+			children = {func->vbound(), func->body()};
+		} else if (auto app = dynamic_cast<const Application *>(expr.get())) {
+			children = {app->func(), app->arg()};
+		}
+
+		bool ready = true;
+		for (auto &child: children) {
+			if (!m_node_ids.count(child.get())) {
+				stack.push_back(child);
+				ready = false;
+			}
+		}
+		if (!ready) {
+			continue;
+		}
+
+		stack.pop_back();
+		if (auto name = dynamic_cast<const Name *>(expr.get())) {
+			m_nodes.push_back(Node{Node::NAME, text(name->name().str()), 0});
+		} else if (auto index = dynamic_cast<const Index *>(expr.get())) {
+			m_nodes.push_back(Node{Node::INDEX, index->index(), 0});
+		} else if (auto num = dynamic_cast<const Numeral *>(expr.get())) {
+			uint64_t value = num->value();
+			m_nodes.push_back(Node{Node::NUMERAL, static_cast<uint32_t>(value), static_cast<uint32_t>(value >> 32)});
+		} else if (auto prim = dynamic_cast<const Primitive *>(expr.get())) {
+			m_nodes.push_back(Node{Node::PRIMITIVE, static_cast<uint32_t>(prim->op()), 0});
+		} else {
+			auto kind = dynamic_cast<const Function *>(expr.get()) ? Node::FUNCTION : Node::APPLICATION;
+			m_nodes.push_back(Node{kind, m_node_ids.at(children[0].get()), m_node_ids.at(children[1].get())});
+		}
+		m_node_ids.emplace(expr.get(), m_nodes.size() - 1);
+	}
+
+	return m_node_ids.at(root.get());
+}
+
+void Writer::write(const string &path) const
+{
+	Header header;
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.entries = m_entries.size();
+	header.nodes = m_nodes.size();
+	header.texts = m_texts.size();
+	header.chars = m_chars.size();
+	header.unused = 0;
+
+	ofstream os(path, std::ios::binary | std::ios::trunc);
+	os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	os.write(reinterpret_cast<const char *>(m_entries.data()), m_entries.size() * sizeof(Entry));
+	os.write(reinterpret_cast<const char *>(m_nodes.data()), m_nodes.size() * sizeof(Node));
+	os.write(reinterpret_cast<const char *>(m_texts.data()), m_texts.size() * sizeof(Text));
+	os.write(m_chars.data(), m_chars.size());
+	os.close();
+
+	if (!os) {
+		throw runtime_error("Could not write image \"" + path + "\"");
+	}
+}
+
+// The file at path mapped read-only for the lifetime of the object
+class Mapping
+{
+public:
+	explicit Mapping(const string &path):
+		m_data(nullptr),
+		m_size(0)
+	{
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw runtime_error("Could not open image \"" + path + "\"");
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			m_size = st.st_size;
+			auto data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data != MAP_FAILED) {
+				m_data = static_cast<const char *>(data);
+			}
+		}
+		close(fd);
+
+		if (!m_data) {
+			throw runtime_error("Could not map image \"" + path + "\"");
+		}
+	}
+
+	~Mapping()
+	{
+		munmap(const_cast<char *>(m_data), m_size);
+	}
+
+	Mapping(const Mapping &) = delete;
+	Mapping &operator=(const Mapping &) = delete;
+
+	const char *data() const
+	{
+		return m_data;
+	}
+
+	size_t size() const
+	{
+		return m_size;
+	}
+
+private:
+	const char *m_data;
+	size_t m_size;
+};
+
+} // namespace
+
+void save(const string &path, const Parser::SymbolTable &syms)
+{
+	Writer writer;
+	for (auto &sym: syms.entries()) {
+		writer.add(sym.first, sym.second.first, sym.second.second);
+	}
+	writer.write(path);
+}
+
+Parser::SymbolTableP load(const string &path)
+{
+	Mapping file(path);
+	auto invalid = [&path]() {
+		return runtime_error("Invalid image \"" + path + "\"");
+	};
+
+	if (file.size() < sizeof(Header)) {
+		throw invalid();
+	}
+	auto header = reinterpret_cast<const Header *>(file.data());
+	if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION) {
+		throw invalid();
+	}
+
+	auto entries = reinterpret_cast<const Entry *>(header + 1);
+	auto nodes = reinterpret_cast<const Node *>(entries + header->entries);
+	auto texts = reinterpret_cast<const Text *>(nodes + header->nodes);
+	auto chars = reinterpret_cast<const char *>(texts + header->texts);
+	uint64_t size = sizeof(Header) +
+		uint64_t(header->entries) * sizeof(Entry) +
+		uint64_t(header->nodes) * sizeof(Node) +
+		uint64_t(header->texts) * sizeof(Text) +
+		header->chars;
+	if (file.size() != size) {
+		throw invalid();
+	}
+
+	auto str = [&](uint32_t text) {
+		if (text >= header->texts || texts[text].offset > header->chars ||
+				texts[text].size > header->chars - texts[text].offset) {
+			throw invalid();
+		}
+		return string(chars + texts[text].offset, texts[text].size);
+	};
+
+	// The definitions outlive any evaluation
+	HeapScope heap;
+
+	vector<ExpressionP> exprs;
+	exprs.reserve(header->nodes);
+	auto ref = [&](uint32_t node) -> const ExpressionP & {
+		if (node >= exprs.size()) {
+			throw invalid();
+		}
+		return exprs[node];
+	};
+
+	for (auto node = nodes; node != nodes + header->nodes; ++node) {
+		switch (node->kind) {
+		case Node::NAME:
+			exprs.push_back(Name::create(str(node->first)));
+			break;
+		case Node::INDEX:
+			exprs.push_back(Index::create(node->first));
+			break;
+		case Node::FUNCTION:
+			{
+				auto vbound = std::dynamic_pointer_cast<Name>(ref(node->first));
+				if (!vbound) {
+					throw invalid();
+				}
+				exprs.push_back(Function::fromIndexed(vbound, ref(node->second)));
+			}
+			break;
+		case Node::APPLICATION:
+			exprs.push_back(Application::create(ref(node->first), ref(node->second)));
+			break;
+		case Node::NUMERAL:
+			exprs.push_back(Numeral::create(node->first | uint64_t(node->second) << 32));
+			break;
+		case Node::PRIMITIVE:
+			if (node->first > static_cast<uint32_t>(Primitive::Op::EQUAL)) {
+				throw invalid();
+			}
+			exprs.push_back(Primitive::create(static_cast<Primitive::Op>(node->first)));
+			break;
+		default:
+			throw invalid();
+		}
+	}
+
+	auto syms = make_shared<Parser::SymbolTable>();
+	for (auto entry = entries; entry != entries + header->entries; ++entry) {
+		syms->set(str(entry->key), std::make_pair(ref(entry->node), entry->arity));
+	}
+	return syms;
+}
+
+} // namespace Image
+} // namespace Lambda
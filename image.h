@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+
+#include "parser.h"
+
+namespace Lambda {
+namespace Image {
+
+// A session image holds a symbol table together with the expressions it
+// refers to, so that a later run can start from it instead of parsing the
+// files again. Nodes are stored once each, children before parents, and refer
+// to each other and to their names by position in the file, so the image can
+// be mapped at any address and turned back into expressions in one pass.
+// Images are only meant to be read by the build that wrote them.
+
+// Write syms to path, throwing std::runtime_error if that fails
+void save(const std::string &path, const Parser::SymbolTable &syms);
+
+// The symbol table in the image at path, throwing std::runtime_error if it
+// cannot be read or is not a valid image
+Parser::SymbolTableP load(const std::string &path);
+
+} // namespace Image
+} // namespace Lambda
@@ -0,0 +1,462 @@
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "budget.h"
+#include "concurrent.h"
+#include "krivine.h"
+#include "memo.h"
+#include "region.h"
+
+using std::atomic;
+using std::memory_order_relaxed;
+using std::shared_ptr;
+using std::unique_ptr;
+using std::vector;
+
+namespace Lambda {
+namespace Krivine {
+
+namespace {
+
+struct Env;
+using EnvP = shared_ptr<const Env>;
+
+// A term together with the bindings of its free indices. A closure without a
+// term stands for the variable of a binder the machine went under, level
+// counting those binders from the outside.
+struct Closure
+{
+	ExpressionP term;
+	EnvP env;
+	unsigned level;
+};
+
+struct Env
+{
+	Env(const Closure &value, const EnvP &next):
+		value(value),
+		next(next) {}
+
+	const Closure value;
+	const EnvP next;
+};
+
+EnvP bind(const Closure &value, const EnvP &next)
+{
+	return makeShared<Env>(value, next);
+}
+
+const Closure &lookup(const Env *env, unsigned index)
+{
+	for (; index > 0; --index) {
+		env = env->next.get();
+	}
+	return env->value;
+}
+
+// Machine steps between looks at whether a task has been cancelled
+const unsigned POLL_INTERVAL = 256;
+
+// Machine steps before any work is handed out, so that a small term is
+// normalized without locks or other threads
+const unsigned WARMUP = 1 << 14;
+
+struct Cancelled {};
+
+Stats::Counters *collecting()
+{
+	auto scope = Stats::Scope::current();
+	return scope ? scope->counters() : nullptr;
+}
+
+// Where a machine taking part in a parallel normalization hands out work, and
+// how it learns that its result is no longer wanted. Null for a machine that
+// runs on its own.
+struct Fork
+{
+	Fork(Pool &pool, const Fork *parent):
+		pool(pool),
+		parent(parent),
+		region(parent ? parent->region : Region::current()),
+		budget(parent ? parent->budget : Budget::current()),
+		stats(parent ? parent->stats : collecting()),
+		cancelled(false),
+		ticks(0) {}
+
+	// Whether to hand out work now. The first task of a normalization is
+	// spawned by its outermost machine, which starts sharing the tables with
+	// the other threads then.
+	bool offer()
+	{
+		if (parent) {
+			return pool.hungry();
+		}
+		if (ticks < WARMUP || !pool.hungry()) {
+			return false;
+		}
+		if (!concurrent) {
+			concurrent.reset(new ConcurrentScope);
+		}
+		return true;
+	}
+
+	// Throws Cancelled every so often if this or an enclosing task has been
+	// cancelled
+	void poll()
+	{
+		if (++ticks % POLL_INTERVAL != 0) {
+			return;
+		}
+		for (const Fork *fork = this; fork; fork = fork->parent) {
+			if (fork->cancelled.load(memory_order_relaxed)) {
+				throw Cancelled{};
+			}
+		}
+	}
+
+	Pool &pool;
+	const Fork *const parent;
+	// Where the nodes of the normalization are built, what it may use, and
+	// what its counts are added to
+	Region *const region;
+	Budget *const budget;
+	Stats::Counters *const stats;
+	atomic<bool> cancelled;
+	unsigned ticks;
+	unique_ptr<ConcurrentScope> concurrent;
+};
+
+struct Job: Pool::Task
+{
+	explicit Job(Fork &parent):
+		fork(parent.pool, &parent),
+		joined(false) {}
+
+	Fork fork;
+	bool joined;
+};
+
+// Puts a job on the region, budget and counters of the normalization it is
+// part of, whichever thread runs it
+class JobScope
+{
+public:
+	explicit JobScope(const Fork &fork):
+		m_region(fork.region),
+		m_budget(fork.budget),
+		m_stats(fork.stats) {}
+
+private:
+	SharedRegionScope m_region;
+	BudgetScope m_budget;
+	Stats::Scope m_stats;
+};
+
+// The tasks one machine has spawned. Those it has not joined when it is done
+// with them, because their result turned out not to be needed or an exception
+// is on its way out, are cancelled and waited for, as they refer to its
+// closures.
+class Jobs
+{
+public:
+	explicit Jobs(Pool &pool):
+		m_pool(pool) {}
+
+	~Jobs()
+	{
+		for (auto &job: m_jobs) {
+			job->fork.cancelled = true;
+		}
+		for (auto it = m_jobs.rbegin(); it != m_jobs.rend(); ++it) {
+			if (!(*it)->joined) {
+				try {
+					m_pool.join(**it);
+				} catch (...) {}
+			}
+		}
+	}
+
+	Jobs(const Jobs &) = delete;
+	Jobs &operator=(const Jobs &) = delete;
+
+	template<typename T, typename... Args>
+	T &spawn(Args&&... args)
+	{
+		auto job = new T(std::forward<Args>(args)...);
+		m_jobs.emplace_back(job);
+		m_pool.spawn(*job);
+		return *job;
+	}
+
+	void join(Job &job)
+	{
+		job.joined = true;
+		m_pool.join(job);
+	}
+
+private:
+	Pool &m_pool;
+	vector<unique_ptr<Job>> m_jobs;
+};
+
+ExpressionP whnf(ExpressionP &term, EnvP &env, vector<Closure> &stack, unsigned depth, Fork *fork);
+
+// Evaluates an argument of a primitive on another thread, in case it is
+// needed
+struct WhnfJob: Job
+{
+	WhnfJob(const Closure &arg, unsigned depth, Fork &parent):
+		Job(parent),
+		term(arg.term),
+		env(arg.env),
+		depth(depth),
+		stuck(false) {}
+
+	virtual void run()
+	{
+		JobScope scope(fork);
+		vector<Closure> rest;
+		stuck = !term || whnf(term, env, rest, depth, &fork);
+	}
+
+	ExpressionP term;
+	EnvP env;
+	const unsigned depth;
+	bool stuck;
+};
+
+// Replaces a primitive applied to the closures on stack by its result, false
+// if it is short of arguments, one of them is not a numeral or the result
+// overflows
+bool delta(const Primitive &prim, ExpressionP &term, EnvP &env, vector<Closure> &stack, unsigned depth, Fork *fork)
+{
+	auto arity = prim.arity();
+	if (stack.size() < arity) {
+		return false;
+	}
+
+	// The arguments after the last are evaluated on idle threads meanwhile,
+	// and dropped if the last turns out not to be a numeral
+	unique_ptr<Jobs> jobs;
+	vector<WhnfJob *> spawned(arity, nullptr);
+	for (unsigned i = arity - 1; i-- > 0 && fork && fork->offer();) {
+		if (!jobs) {
+			jobs.reset(new Jobs(fork->pool));
+		}
+		spawned[i] = &jobs->spawn<WhnfJob>(stack[stack.size() - 1 - i], depth, *fork);
+	}
+
+	// The last argument is evaluated first
+	vector<unsigned long> values(arity);
+	for (unsigned i = arity; i-- > 0;) {
+		auto arg = stack[stack.size() - 1 - i];
+		if (prim.lazy()) {
+			// Only looked at, through the variables it is bound to
+			while (auto index = dynamic_cast<const Index *>(arg.term.get())) {
+				auto bound = lookup(arg.env.get(), index->index());
+				arg = bound;
+			}
+		} else if (auto job = spawned[i]) {
+			jobs->join(*job);
+			if (job->stuck) {
+				return false;
+			}
+			arg.term = job->term;
+		} else {
+			vector<Closure> rest;
+			if (!arg.term || whnf(arg.term, arg.env, rest, depth, fork)) {
+				return false;
+			}
+		}
+		auto num = dynamic_cast<const Numeral *>(arg.term.get());
+		if (!num) {
+			return false;
+		}
+		values[i] = num->value();
+	}
+
+	auto result = prim.apply(values);
+	if (!result) {
+		return false;
+	}
+	stack.resize(stack.size() - arity);
+	term = result;
+	env = nullptr;
+	return true;
+}
+
+// Runs the machine on term in env, applied to the closures on stack with the
+// first argument on top, until it is an abstraction or a numeral with no
+// arguments left, or stuck on a variable. Returns the variable in the last
+// case and null otherwise. depth is the number of binders gone under to reach
+// term.
+ExpressionP whnf(ExpressionP &term, EnvP &env, vector<Closure> &stack, unsigned depth, Fork *fork)
+{
+	while (true) {
+		Budget::step();
+		if (fork) {
+			fork->poll();
+		}
+
+		if (auto app = dynamic_cast<const Application *>(term.get())) {
+			stack.push_back(Closure{app->arg(), env, 0});
+			term = app->func();
+		} else if (auto func = dynamic_cast<const Function *>(term.get())) {
+			if (stack.empty()) {
+				return nullptr;
+			}
+			Stats::beta();
+			env = bind(stack.back(), env);
+			stack.pop_back();
+			term = func->body();
+		} else if (auto index = dynamic_cast<const Index *>(term.get())) {
+			auto &closure = lookup(env.get(), index->index());
+			if (!closure.term) {
+				return Index::create(depth - 1 - closure.level);
+			}
+			term = closure.term;
+			env = closure.env;
+		} else if (auto num = dynamic_cast<const Numeral *>(term.get())) {
+			if (stack.empty()) {
+				return nullptr;
+			}
+			term = num->unfold();
+			env = nullptr;
+		} else if (auto prim = dynamic_cast<const Primitive *>(term.get())) {
+			if (!delta(*prim, term, env, stack, depth, fork)) {
+				term = prim->definition();
+				env = nullptr;
+			}
+		} else {
+			return term;
+		}
+	}
+}
+
+ExpressionP normalize(ExpressionP term, EnvP env, unsigned depth, Fork *fork);
+
+// Normalizes an argument of a variable on another thread
+struct ArgJob: Job
+{
+	ArgJob(const Closure &arg, unsigned depth, Fork &parent):
+		Job(parent),
+		arg(arg),
+		depth(depth) {}
+
+	virtual void run()
+	{
+		JobScope scope(fork);
+		result = normalize(arg.term, arg.env, depth, &fork);
+	}
+
+	const Closure arg;
+	const unsigned depth;
+	ExpressionP result;
+};
+
+// Whether normalizing arg takes more than looking it up
+bool worthJob(const Closure &arg)
+{
+	auto term = arg.term.get();
+	auto env = arg.env.get();
+	while (auto index = dynamic_cast<const Index *>(term)) {
+		auto &closure = lookup(env, index->index());
+		term = closure.term.get();
+		env = closure.env.get();
+	}
+	return term && !dynamic_cast<const Name *>(term) && !dynamic_cast<const Numeral *>(term);
+}
+
+// head applied to the normal forms of the closures on stack. Every argument
+// is part of the result, so while there are idle threads the ones furthest
+// from being reached are handed to them.
+ExpressionP spread(ExpressionP head, const vector<Closure> &stack, unsigned depth, Fork &fork)
+{
+	Jobs jobs(fork.pool);
+	vector<ArgJob *> spawned(stack.size(), nullptr);
+	// The last argument is at the bottom of the stack
+	size_t offered = 0;
+
+	for (auto i = stack.size(); i-- > 0;) {
+		for (; offered < i && fork.offer(); ++offered) {
+			if (worthJob(stack[offered])) {
+				spawned[offered] = &jobs.spawn<ArgJob>(stack[offered], depth, fork);
+			}
+		}
+
+		ExpressionP arg;
+		if (auto job = spawned[i]) {
+			jobs.join(*job);
+			arg = job->result;
+		} else {
+			arg = normalize(stack[i].term, stack[i].env, depth, &fork);
+		}
+		head = Application::create(head, arg);
+	}
+
+	return head;
+}
+
+// The normal form of term in env, found by running the machine
+ExpressionP run(ExpressionP term, EnvP env, unsigned depth, Fork *fork)
+{
+	vector<Closure> stack;
+	auto head = whnf(term, env, stack, depth, fork);
+
+	if (!head) {
+		auto func = dynamic_cast<const Function *>(term.get());
+		if (!func) {
+			// A numeral is already in normal form
+			return term;
+		}
+		auto var = bind(Closure{nullptr, nullptr, depth}, env);
+		return Function::fromIndexed(func->vbound(), normalize(func->body(), var, depth + 1, fork));
+	}
+
+	if (fork && stack.size() > 1) {
+		return spread(head, stack, depth, *fork);
+	}
+
+	// The first argument is on top of the stack
+	while (!stack.empty()) {
+		auto arg = normalize(stack.back().term, stack.back().env, depth, fork);
+		head = Application::create(head, arg);
+		stack.pop_back();
+	}
+
+	return head;
+}
+
+ExpressionP normalize(ExpressionP term, EnvP env, unsigned depth, Fork *fork)
+{
+	// Only closed terms are remembered, and they mean the same in any env
+	// and at any depth
+	if (auto normal = Memo::lookup(term)) {
+		return normal;
+	}
+
+	auto normal = run(term, env, depth, fork);
+	Memo::store(term, normal);
+	return normal;
+}
+
+} // namespace
+
+ExpressionP normalize(const ExpressionP expr)
+{
+	return normalize(expr, nullptr, 0, nullptr);
+}
+
+ExpressionP normalize(const ExpressionP expr, Pool &pool)
+{
+	if (pool.threads() == 1) {
+		return normalize(expr);
+	}
+
+	Fork fork(pool, nullptr);
+	return normalize(expr, nullptr, 0, &fork);
+}
+
+} // namespace Krivine
+} // namespace Lambda
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "lambda.h"
+#include "pool.h"
+
+namespace Lambda {
+namespace Krivine {
+
+// Normal form of expr, computed by a Krivine machine that keeps variable
+// bindings in environments of closures instead of substituting into terms.
+// When the machine stops at an abstraction or a variable it carries on under
+// the binder or into the arguments, so reduction is normal order throughout
+// and the result is the same as repeated Nreduce1.
+ExpressionP normalize(const ExpressionP expr);
+
+// The same normal form, computed on the threads of pool. Once the machine is
+// stuck on a variable all of its arguments are needed, so they are normalized
+// side by side. The arguments of a primitive are evaluated side by side too,
+// and the work on those it turns out not to need is cancelled, so the result
+// is the same as for one thread and nothing runs that would not terminate
+// there. Nothing is handed out before the machine has run for a while, or
+// while no thread is idle, so a small term is normalized by a single machine
+// all the same.
+ExpressionP normalize(const ExpressionP expr, Pool &pool);
+
+} // namespace Krivine
+} // namespace Lambda
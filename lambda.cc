@@ -1,72 +1,843 @@
+#include <climits>
+#include <mutex>
+#include <unordered_map>
+
+#include "budget.h"
+#include "builtins.h"
+#include "concurrent.h"
+#include "krivine.h"
 #include "lambda.h"
+#include "lazy.h"
+#include "memo.h"
+#include "nbe.h"
+#include "optimal.h"
+#include "pool.h"
+#include "printer.h"
+#include "region.h"
+#include "trace.h"
+#include "vm.h"
+#include "zipper.h"
 
+using std::mutex;
 using std::ostream;
 using std::dynamic_pointer_cast;
+using std::shared_ptr;
+using std::static_pointer_cast;
+using std::string;
+using std::unordered_multimap;
+using std::vector;
+using std::weak_ptr;
 
 namespace Lambda {
 
-ostream &operator<<(ostream &os, const ExpressionP& expr)
+namespace {
+
+// The table only holds weak references, a node removes itself when destroyed
+struct TermEntry
+{
+	const Expression *raw;
+	weak_ptr<Expression> node;
+};
+
+// Split by hash so that threads creating nodes at the same time rarely wait
+// for the same lock
+struct TermShard
+{
+	mutex lock;
+	unordered_multimap<size_t, TermEntry> table;
+};
+
+const size_t TERM_SHARDS = 64;
+
+// Never destroyed, nodes in static storage may outlive it otherwise
+TermShard &terms(size_t hash)
 {
-	if (!expr) {
-		os << "<null expression>";
+	static auto shards = new TermShard[TERM_SHARDS];
+	return shards[(hash ^ hash >> 32) % TERM_SHARDS];
+}
+
+size_t mix(size_t seed, size_t value)
+{
+	return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+enum : size_t {
+	NAME_SEED = 1,
+	INDEX_SEED,
+	FUNCTION_SEED,
+	APPLICATION_SEED,
+	NUMERAL_SEED,
+	PRIMITIVE_SEED
+};
+
+template<typename T, typename Same, typename... Args>
+shared_ptr<T> hashCons(Stats::Node kind, size_t hash, Same same, Args&&... args)
+{
+	// Another thread may drop its last reference to a node locked here, so
+	// the ones that do not match are let go of after the lock, when their
+	// destructors can take it
+	vector<ExpressionP> misses;
+
+	auto &shard = terms(hash);
+	ConcurrentLock lock(shard.lock);
+	auto range = shard.table.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it) {
+		if (auto node = it->second.node.lock()) {
+			auto candidate = dynamic_cast<const T *>(node.get());
+			if (candidate && same(*candidate)) {
+				return static_pointer_cast<T>(node);
+			}
+			misses.push_back(node);
+		}
 	}
-	expr->print(os);
-	return os;
+
+	auto node = makeShared<T>(std::forward<Args>(args)...);
+	shard.table.emplace(hash, TermEntry{node.get(), node});
+	Stats::created(kind, node->size(), node->depth());
+	return node;
 }
 
-ExpressionP Nreduce1(const ExpressionP expr)
+// Children whose last reference went with a parent being destroyed on this
+// thread, and whether a destructor further up is already destroying them.
+// Never freed, as nodes in static storage may be destroyed after it.
+thread_local vector<ExpressionP> *t_released = nullptr;
+thread_local bool t_releasing = false;
+
+ExpressionP own(const Expression &node)
 {
-	if (auto app = dynamic_pointer_cast<Application>(expr)) {
-		if (auto reduced = app->apply()) {
-			return reduced;
-		} else if (auto new_func = Nreduce1(app->func())) {
-			return Application::create(new_func, app->arg());
-		} else if (auto new_arg = Nreduce1(app->arg())) {
-			return Application::create(app->func(), new_arg);
+	return std::const_pointer_cast<Expression>(node.shared_from_this());
+}
+
+// A part of a term being rebuilt, below depth binders, and whether its own
+// parts have been pushed
+struct Rebuild
+{
+	const Expression *node;
+	unsigned depth;
+	bool entered;
+};
+
+// Terms no deeper than this are rebuilt by recursion, which saves the
+// stacks the rest need and takes a bounded amount of the call stack
+const unsigned SHALLOW = 256;
+
+// Rebuild for a term no deeper than SHALLOW
+template<typename Leaf>
+ExpressionP rebuildShallow(const Expression &expr, unsigned depth, Leaf &leaf)
+{
+	if (auto result = leaf(expr, depth)) {
+		return result;
+	}
+	if (auto func = dynamic_cast<const Function *>(&expr)) {
+		auto body = rebuildShallow(*func->body(), depth + 1, leaf);
+		return body != func->body() ? Function::fromIndexed(func->vbound(), body) : own(expr);
+	} else if (auto app = dynamic_cast<const Application *>(&expr)) {
+		auto func = rebuildShallow(*app->func(), depth, leaf);
+		auto arg = rebuildShallow(*app->arg(), depth, leaf);
+		return func != app->func() || arg != app->arg() ? Application::create(func, arg) : own(expr);
+	}
+	return own(expr);
+}
+
+// Expr with every part that leaf gives a result for replaced by it. Leaf is
+// asked about each part, outermost first, with the number of binders above
+// it, and returns null to have the parts of a Function or an Application
+// looked at in turn. A node whose parts all come back as they were is kept.
+template<typename Leaf>
+ExpressionP rebuild(const Expression &expr, unsigned depth, Leaf leaf)
+{
+	if (expr.depth() <= SHALLOW) {
+		return rebuildShallow(expr, depth, leaf);
+	}
+
+	vector<Rebuild> stack{Rebuild{&expr, depth, false}};
+	vector<ExpressionP> results;
+
+	while (!stack.empty()) {
+		auto frame = stack.back();
+		if (!frame.entered) {
+			if (auto result = leaf(*frame.node, frame.depth)) {
+				results.push_back(std::move(result));
+				stack.pop_back();
+				continue;
+			}
+			stack.back().entered = true;
+			if (auto func = dynamic_cast<const Function *>(frame.node)) {
+				stack.push_back(Rebuild{func->body().get(), frame.depth + 1, false});
+			} else if (auto app = dynamic_cast<const Application *>(frame.node)) {
+				stack.push_back(Rebuild{app->arg().get(), frame.depth, false});
+				stack.push_back(Rebuild{app->func().get(), frame.depth, false});
+			}
+			continue;
 		}
-	} else if (auto func = dynamic_pointer_cast<Function>(expr)) {
-		auto new_body = Nreduce1(func->body());
-		if (new_body) {
-			return Function::create(func->vbound(), new_body);
+
+		stack.pop_back();
+		if (auto func = dynamic_cast<const Function *>(frame.node)) {
+			auto &body = results.back();
+			if (body != func->body()) {
+				body = Function::fromIndexed(func->vbound(), body);
+			} else {
+				body = own(*func);
+			}
+		} else if (auto app = dynamic_cast<const Application *>(frame.node)) {
+			auto arg = std::move(results.back());
+			results.pop_back();
+			auto &func = results.back();
+			if (func != app->func() || arg != app->arg()) {
+				func = Application::create(func, arg);
+			} else {
+				func = own(*app);
+			}
+		} else {
+			results.push_back(own(*frame.node));
+		}
+	}
+
+	return results.back();
+}
+
+} // namespace
+
+Expression::~Expression()
+{
+	auto &shard = terms(m_hash);
+	ConcurrentLock lock(shard.lock);
+	auto range = shard.table.equal_range(m_hash);
+	for (auto it = range.first; it != range.second; ++it) {
+		if (it->second.raw == this) {
+			shard.table.erase(it);
+			break;
+		}
+	}
+}
+
+void Expression::release(const ExpressionP &part)
+{
+	// The node is being destroyed, so nothing reads its members any more
+	auto &owned = const_cast<ExpressionP &>(part);
+	if (owned.use_count() != 1) {
+		return;
+	}
+
+	if (!t_released) {
+		t_released = new vector<ExpressionP>;
+	}
+	t_released->push_back(std::move(owned));
+	if (t_releasing) {
+		return;
+	}
+
+	t_releasing = true;
+	while (!t_released->empty()) {
+		// Whatever its destructor lets go of is queued behind it
+		auto last = std::move(t_released->back());
+		t_released->pop_back();
+	}
+	t_releasing = false;
+}
+
+ExpressionP Expression::abstract(const Name &name, unsigned depth) const
+{
+	return rebuild(*this, depth, [&](const Expression &node, unsigned at) -> ExpressionP {
+		if (!node.named()) {
+			return own(node);
+		}
+		if (auto var = dynamic_cast<const Name *>(&node)) {
+			return *var == name ? Index::create(at) : own(node);
+		}
+		return nullptr;
+	});
+}
+
+ExpressionP Expression::substitute(unsigned depth, const ExpressionP expr) const
+{
+	return rebuild(*this, depth, [&](const Expression &node, unsigned at) -> ExpressionP {
+		if (node.loose() <= at) {
+			return own(node);
 		}
+		if (auto index = dynamic_cast<const Index *>(&node)) {
+			if (index->index() == at) {
+				return expr->shift(at, 0);
+			}
+			return Index::create(index->index() - 1);
+		}
+		return nullptr;
+	});
+}
+
+ExpressionP Expression::shift(unsigned by, unsigned cutoff) const
+{
+	if (by == 0) {
+		return self();
+	}
+	return rebuild(*this, cutoff, [&](const Expression &node, unsigned at) -> ExpressionP {
+		if (node.loose() <= at) {
+			return own(node);
+		}
+		if (auto index = dynamic_cast<const Index *>(&node)) {
+			return Index::create(index->index() + by);
+		}
+		return nullptr;
+	});
+}
+
+ostream &operator<<(ostream &os, const ExpressionP& expr)
+{
+	Printer(os).print(expr);
+	return os;
+}
+
+NameP Name::create(Symbol name)
+{
+	return hashCons<Name>(Stats::Node::NAME, hashOf(name),
+		[&](const Name &other) { return other.m_name == name; },
+		name);
+}
+
+size_t Name::hashOf(Symbol name)
+{
+	return mix(NAME_SEED, name.id());
+}
+
+IndexP Index::create(unsigned index)
+{
+	return hashCons<Index>(Stats::Node::INDEX, hashOf(index),
+		[&](const Index &other) { return other.m_index == index; },
+		index);
+}
+
+size_t Index::hashOf(unsigned index)
+{
+	return mix(INDEX_SEED, index);
+}
+
+FunctionP Function::fromIndexed(const NameP vbound, const ExpressionP body)
+{
+	return hashCons<Function>(Stats::Node::FUNCTION, hashOf(vbound, body),
+		[&](const Function &other) {
+			return other.m_vbound == vbound && other.m_body == body;
+		},
+		vbound, body);
+}
+
+size_t Function::hashOf(const NameP vbound, const ExpressionP body)
+{
+	return mix(mix(FUNCTION_SEED, vbound->hash()), body->hash());
+}
+
+Function::~Function()
+{
+	release(m_body);
+}
+
+ApplicationP Application::create(const ExpressionP func, const ExpressionP arg)
+{
+	return hashCons<Application>(Stats::Node::APPLICATION, hashOf(func, arg),
+		[&](const Application &other) {
+			return other.m_func == func && other.m_arg == arg;
+		},
+		func, arg);
+}
+
+size_t Application::hashOf(const ExpressionP func, const ExpressionP arg)
+{
+	return mix(mix(APPLICATION_SEED, func->hash()), arg->hash());
+}
+
+Application::~Application()
+{
+	release(m_func);
+	release(m_arg);
+}
+
+NumeralP Numeral::create(unsigned long value)
+{
+	return hashCons<Numeral>(Stats::Node::NUMERAL, hashOf(value),
+		[&](const Numeral &other) { return other.m_value == value; },
+		value);
+}
+
+size_t Numeral::hashOf(unsigned long value)
+{
+	return mix(NUMERAL_SEED, value);
+}
+
+ExpressionP Numeral::unfold() const
+{
+	if (m_value == 0) {
+		return Terms::Term<Expressions::ZeroLambda>{};
+	}
+
+	static const auto s = Name::create("s");
+	return Function::fromIndexed(s,
+		Application::create(
+			Application::create(Index::create(0), Expressions::false_func),
+			create(m_value - 1)
+		)
+	);
+}
+
+PrimitiveP Primitive::create(Op op)
+{
+	return hashCons<Primitive>(Stats::Node::PRIMITIVE, hashOf(op),
+		[&](const Primitive &other) { return other.m_op == op; },
+		op);
+}
+
+size_t Primitive::hashOf(Op op)
+{
+	return mix(PRIMITIVE_SEED, static_cast<size_t>(op));
+}
+
+unsigned Primitive::arity() const
+{
+	switch (m_op) {
+	case Op::SUCC:
+	case Op::PRED:
+	case Op::ISZERO:
+		return 1;
+	case Op::ADD:
+	case Op::SUB:
+	case Op::MULT:
+	case Op::EQUAL:
+		return 2;
+	}
+
+	return 0;
+}
+
+ExpressionP Primitive::definition() const
+{
+	using namespace Expressions;
+	using Terms::Term;
+
+	switch (m_op) {
+	case Op::SUCC:
+		return Term<SuccLambda>{};
+	case Op::PRED:
+		return Term<PredLambda>{};
+	case Op::ISZERO:
+		return Term<IsZeroLambda>{};
+	case Op::ADD:
+		return Term<AddLambda>{};
+	case Op::SUB:
+		return Term<SubLambda>{};
+	case Op::MULT:
+		return Term<MultLambda>{};
+	case Op::EQUAL:
+		return Term<EqualLambda>{};
+	}
+
+	return nullptr;
+}
+
+namespace {
+
+ExpressionP truth(bool value)
+{
+	if (value) {
+		return Expressions::true_func;
+	}
+	return Expressions::false_func;
+}
+
+} // namespace
+
+bool Primitive::lazy() const
+{
+	return m_op == Op::SUCC;
+}
+
+bool Primitive::overflows(const vector<unsigned long> &args) const
+{
+	switch (m_op) {
+	case Op::SUCC:
+		return args[0] == ULONG_MAX;
+	case Op::ADD:
+		return args[0] > ULONG_MAX - args[1];
+	case Op::MULT:
+		return args[1] && args[0] > ULONG_MAX / args[1];
+	case Op::PRED:
+	case Op::ISZERO:
+	case Op::SUB:
+	case Op::EQUAL:
+		return false;
+	}
+
+	return false;
+}
+
+ExpressionP Primitive::apply(const vector<unsigned long> &args) const
+{
+	if (overflows(args)) {
+		return nullptr;
+	}
+
+	Stats::delta();
+	switch (m_op) {
+	case Op::SUCC:
+		return Numeral::create(args[0] + 1);
+	case Op::PRED:
+		return Numeral::create(args[0] ? args[0] - 1 : 0);
+	case Op::ISZERO:
+		return truth(args[0] == 0);
+	case Op::ADD:
+		return Numeral::create(args[0] + args[1]);
+	case Op::SUB:
+		return Numeral::create(args[0] > args[1] ? args[0] - args[1] : 0);
+	case Op::MULT:
+		return Numeral::create(args[0] * args[1]);
+	case Op::EQUAL:
+		return truth(args[0] == args[1]);
 	}
 
 	return nullptr;
 }
 
+const char *Primitive::name() const
+{
+	switch (m_op) {
+	case Op::SUCC:
+		return "builtin_succ";
+	case Op::PRED:
+		return "builtin_pred";
+	case Op::ISZERO:
+		return "builtin_iszero";
+	case Op::ADD:
+		return "builtin_add";
+	case Op::SUB:
+		return "builtin_sub";
+	case Op::MULT:
+		return "builtin_mult";
+	case Op::EQUAL:
+		return "builtin_equal";
+	}
+
+	return "";
+}
+
+const Expression *head(const Expression &expr, unsigned &args)
+{
+	auto node = &expr;
+	args = 0;
+	while (auto app = dynamic_cast<const Application *>(node)) {
+		node = app->func().get();
+		++args;
+	}
+	return node;
+}
+
+bool weakHeadNormal(const Expression &expr)
+{
+	unsigned args;
+	auto node = head(expr, args);
+	if (auto prim = dynamic_cast<const Primitive *>(node)) {
+		return args < prim->arity();
+	}
+	return args == 0 || !(dynamic_cast<const Function *>(node) || dynamic_cast<const Numeral *>(node));
+}
+
+const Primitive *saturated(const Expression &expr)
+{
+	unsigned args;
+	auto node = head(expr, args);
+	return saturated(*node, args);
+}
+
+const Primitive *saturated(const Expression &head, unsigned args)
+{
+	auto prim = dynamic_cast<const Primitive *>(&head);
+	return prim && args == prim->arity() ? prim : nullptr;
+}
+
+namespace {
+
+// Func applied to args, last first
+ExpressionP applied(ExpressionP func, const vector<ExpressionP> &args)
+{
+	for (auto it = args.rbegin(); it != args.rend(); ++it) {
+		func = Application::create(func, *it);
+	}
+	return func;
+}
+
+// The step Dreduce1 takes at the root of expr, if it gets a result there.
+// prim is the saturated primitive heading expr, null if there is none.
+// Without a result for it, args are its arguments, last first, and reduce the
+// argument to take a step in.
+ExpressionP delta(const ExpressionP &expr, const Primitive *prim, vector<ExpressionP> &args, size_t &reduce)
+{
+	auto app = dynamic_cast<const Application *>(expr.get());
+	if (!app) {
+		return nullptr;
+	}
+
+	if (auto num = dynamic_cast<const Numeral *>(app->func().get())) {
+		return Application::create(num->unfold(), app->arg());
+	}
+
+	if (!prim) {
+		return nullptr;
+	}
+
+	args.clear();
+	for (; app; app = dynamic_cast<const Application *>(app->func().get())) {
+		args.push_back(app->arg());
+	}
+
+	vector<unsigned long> values(args.size());
+	for (size_t i = 0; i < args.size(); ++i) {
+		if (auto num = dynamic_cast<const Numeral *>(args[i].get())) {
+			values[args.size() - 1 - i] = num->value();
+			continue;
+		}
+
+		if (prim->lazy() || weakHeadNormal(*args[i])) {
+			return applied(prim->definition(), args);
+		}
+		reduce = i;
+		return nullptr;
+	}
+
+	if (auto result = prim->apply(values)) {
+		return result;
+	}
+	return applied(prim->definition(), args);
+}
+
+// Where Nreduce1 went down to look for a step, and how to put the step it
+// found there back into the term
+struct Context
+{
+	enum class Kind {
+		// The function of an application, its argument still to look in
+		FUNC,
+		ARG,
+		BODY,
+		// An argument of a saturated primitive
+		DELTA
+	};
+
+	Kind kind;
+	// Kept by the term being searched
+	const Expression *node;
+	const Primitive *prim;
+	vector<ExpressionP> args;
+	size_t reduce;
+
+	// The node with part, the step taken below, in place
+	ExpressionP plug(const ExpressionP &part)
+	{
+		switch (kind) {
+		case Kind::FUNC:
+			return Application::create(part, static_cast<const Application &>(*node).arg());
+		case Kind::ARG:
+			return Application::create(static_cast<const Application &>(*node).func(), part);
+		case Kind::BODY:
+			return Function::fromIndexed(static_cast<const Function &>(*node).vbound(), part);
+		case Kind::DELTA:
+			args[reduce] = part;
+			return applied(Primitive::create(prim->op()), args);
+		}
+		return nullptr;
+	}
+};
+
+} // namespace
+
+ExpressionP Dreduce1(const ExpressionP expr)
+{
+	return Dreduce1(expr, saturated(*expr));
+}
+
+ExpressionP Dreduce1(const ExpressionP expr, const Primitive *prim)
+{
+	vector<ExpressionP> args;
+	size_t reduce;
+	if (auto reduced = delta(expr, prim, args, reduce)) {
+		return reduced;
+	}
+	if (!prim) {
+		return nullptr;
+	}
+
+	args[reduce] = Nreduce1(args[reduce]);
+	return applied(Primitive::create(prim->op()), args);
+}
+
+// The search goes down the term from a stack of its own rather than by
+// recursion, and rebuilds the way back up around the first step it finds
+ExpressionP Nreduce1(const ExpressionP expr)
+{
+	vector<Context> path;
+	path.reserve(std::min(expr->depth(), SHALLOW));
+	auto node = expr;
+	vector<ExpressionP> args;
+	size_t reduce;
+
+	// The head of the applications along the left of node and how many there
+	// are, found once at the top of them and counted down on the way to the
+	// head, so that each one is checked for a saturated primitive in constant
+	// time. Null until node is an application at the top.
+	const Expression *spine = nullptr;
+	unsigned spineArgs = 0;
+
+	while (true) {
+		ExpressionP reduced;
+		if (auto normal = Memo::lookup(node)) {
+			// Straight to the normal form, or nothing to do
+			reduced = normal == node ? nullptr : normal;
+		} else if (auto app = dynamic_cast<const Application *>(node.get())) {
+			if (!spine) {
+				spine = head(*node, spineArgs);
+			}
+			auto prim = saturated(*spine, spineArgs);
+			if (!(reduced = app->apply()) && !(reduced = delta(node, prim, args, reduce))) {
+				if (prim) {
+					path.push_back(Context{Context::Kind::DELTA, app, prim, std::move(args), reduce});
+					node = path.back().args[reduce];
+					spine = nullptr;
+				} else {
+					path.push_back(Context{Context::Kind::FUNC, app, nullptr, {}, 0});
+					node = app->func();
+					--spineArgs;
+				}
+				continue;
+			}
+		} else if (auto func = dynamic_cast<const Function *>(node.get())) {
+			path.push_back(Context{Context::Kind::BODY, func, nullptr, {}, 0});
+			node = func->body();
+			spine = nullptr;
+			continue;
+		} else if (auto bare = dynamic_cast<const Primitive *>(node.get())) {
+			// Short of arguments
+			reduced = bare->definition();
+		}
+
+		// Back up to where there is somewhere else to look, or to the root
+		while (!path.empty()) {
+			auto &context = path.back();
+			if (reduced) {
+				reduced = context.plug(reduced);
+			} else if (context.kind == Context::Kind::FUNC || context.kind == Context::Kind::DELTA) {
+				// On to the next part, as the application is looked at in
+				// turn for a delta step, in its function and in its argument
+				auto &app = static_cast<const Application &>(*context.node);
+				if (context.kind == Context::Kind::FUNC) {
+					context.kind = Context::Kind::ARG;
+					node = app.arg();
+					spine = nullptr;
+				} else {
+					context.kind = Context::Kind::FUNC;
+					spine = context.prim;
+					spineArgs = context.prim->arity() - 1;
+					context.args.clear();
+					node = app.func();
+				}
+				break;
+			}
+			path.pop_back();
+		}
+		if (path.empty()) {
+			return reduced;
+		}
+	}
+}
+
 ExpressionP Areduce1(const ExpressionP expr)
 {
+	if (auto normal = Memo::lookup(expr)) {
+		// Straight to the normal form, or nothing to do
+		return normal == expr ? nullptr : normal;
+	}
+
 	if (auto app = dynamic_pointer_cast<Application>(expr)) {
 		if (auto new_arg = Nreduce1(app->arg())) {
 			return Application::create(app->func(), new_arg);
 		} else if (auto reduced = app->apply()) {
 			return reduced;
+		} else if (auto reduced = Dreduce1(expr)) {
+			return reduced;
 		} else if (auto new_func = Nreduce1(app->func())) {
 			return Application::create(new_func, app->arg());
 		}
 	} else if (auto func = dynamic_pointer_cast<Function>(expr)) {
 		auto new_body = Nreduce1(func->body());
 		if (new_body) {
-			return Function::create(func->vbound(), new_body);
+			return Function::fromIndexed(func->vbound(), new_body);
 		}
+	} else if (auto prim = dynamic_pointer_cast<Primitive>(expr)) {
+		return prim->definition();
 	}
 
 	return nullptr;
 }
 
-ExpressionP reduce(ExpressionP expr)
+namespace {
+
+// Applies reduce1 until it finds nothing left to reduce. The budget in force,
+// if any, is what stops a term without a normal form.
+ExpressionP reduceSteps(ExpressionP expr, ExpressionP (*reduce1)(const ExpressionP))
 {
 	ExpressionP result{expr};
 
-	for(auto i=MAX_REDUCE_STEPS; i>0; ++i) {
-		auto interm = Areduce1(result);
+	while (true) {
+		Budget::step();
+		auto interm = reduce1(result);
 		if (!interm) {
 			return result;
 		}
 		result = interm;
 	}
+}
+
+ExpressionP normalize(ExpressionP expr, Engine engine)
+{
+	auto trace = Trace::Scope::current();
+	if (trace && (engine == Engine::APPLICATIVE || engine == Engine::NORMAL || engine == Engine::ZIPPER)) {
+		return trace->normalize(expr, engine);
+	}
+
+	switch (engine) {
+	case Engine::APPLICATIVE:
+		return reduceSteps(expr, Areduce1);
+	case Engine::NORMAL:
+		return reduceSteps(expr, Nreduce1);
+	case Engine::KRIVINE:
+		return Krivine::normalize(expr);
+	case Engine::LAZY:
+		return Lazy::normalize(expr);
+	case Engine::ZIPPER: {
+		Zipper zipper{expr};
+		do {
+			Budget::step();
+		} while (zipper.step());
+		return zipper.term();
+	}
+	case Engine::NBE:
+		return NbE::normalize(expr);
+	case Engine::VM:
+		return VM::normalize(expr);
+	case Engine::OPTIMAL:
+		return Optimal::normalize(expr);
+	case Engine::PARALLEL:
+		return Krivine::normalize(expr, Pool::shared());
+	}
+
+	return nullptr;
+}
+
+} // namespace
+
+ExpressionP reduce(ExpressionP expr, Engine engine)
+{
+	if (auto normal = Memo::lookup(expr)) {
+		return normal;
+	}
 
-	throw TooManyStepsError{};
+	auto normal = normalize(expr, engine);
+	Memo::store(expr, normal);
+	return normal;
 }
 
 } // namespace Lambda
@@ -1,15 +1,18 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
-namespace Lambda {
-
-const unsigned MAX_REDUCE_STEPS = 1024;
+#include "stats.h"
+#include "symbol.h"
 
-struct TooManyStepsError {};
+namespace Lambda {
 
 class Expression;
 using ExpressionP = std::shared_ptr<Expression>;
@@ -17,117 +20,197 @@ using ExpressionP = std::shared_ptr<Expression>;
 class Name;
 using NameP = std::shared_ptr<Name>;
 
+class Index;
+using IndexP = std::shared_ptr<Index>;
+
 class Function;
 using FunctionP = std::shared_ptr<Function>;
 
 class Application;
 using ApplicationP = std::shared_ptr<Application>;
 
-class Expression
-{
-public:
-	virtual std::pair<bool, ExpressionP> replace(const NameP name, const ExpressionP expr) const = 0;
-	virtual void print(std::ostream &os) const = 0;
+class Numeral;
+using NumeralP = std::shared_ptr<Numeral>;
 
-	virtual ~Expression() {}
-};
+class Primitive;
+using PrimitiveP = std::shared_ptr<Primitive>;
 
-class Name: public Expression
+// Bound variables are de Bruijn indices and only free variables carry a Name,
+// so substitution never has to rename a binder. The name a binder was written
+// with is kept as a hint for printing.
+//
+// Expressions are hash-consed: the create() factories return the existing node
+// for a structurally identical expression, so equal expressions are the same
+// pointer.
+class Expression: public std::enable_shared_from_this<Expression>
 {
 public:
-	static NameP create(const std::string &name)
+	// These rebuild the expression from a stack of their own, so they take
+	// no more of the call stack however deep it is, and return the very node
+	// for any part they leave as it was.
+
+	// Turn the free occurrences of name into the index of a binder depth
+	// levels up
+	ExpressionP abstract(const Name &name, unsigned depth) const;
+
+	// Replace index depth with expr and lower the indices above it
+	ExpressionP substitute(unsigned depth, const ExpressionP expr) const;
+
+	// Raise the indices at or above cutoff by the given amount
+	ExpressionP shift(unsigned by, unsigned cutoff) const;
+
+	// One more than the largest index escaping this expression, zero if there
+	// is none
+	unsigned loose() const
 	{
-		return std::make_shared<Name>(name);
+		return m_loose;
 	}
 
-	explicit Name(const std::string &name): m_name(name) {}
+	// Whether a free Name occurs in this expression
+	bool named() const
+	{
+		return m_named;
+	}
 
-	virtual std::pair<bool, ExpressionP> replace(const NameP name, const ExpressionP expr) const
+	// Structural hash, computed once when the node is created
+	size_t hash() const
 	{
-		if (name->name() == m_name) {
-			return std::make_pair(true, expr);
-		} else {
-			return std::make_pair(false, create(m_name));
-		}
+		return m_hash;
 	}
 
-	virtual void print(std::ostream &os) const
+	// The number of nodes and the longest path from the root to a leaf,
+	// counting shared subterms every time they occur, up to the largest
+	// unsigned
+	unsigned size() const
 	{
-		os << m_name;
+		return m_size;
 	}
 
-	bool operator==(const Name& other) const
+	unsigned depth() const
 	{
-		return this == &other || m_name == other.m_name;
+		return m_depth;
 	}
 
-	const std::string &name() const
+	virtual ~Expression();
+
+protected:
+	Expression(size_t hash, unsigned loose, bool named, unsigned size = 1, unsigned depth = 1):
+		m_hash(hash),
+		m_loose(loose),
+		m_size(size),
+		m_depth(depth),
+		m_named(named) {}
+
+	// One more than a + b, saturating
+	static unsigned grow(unsigned a, unsigned b)
 	{
-		return m_name;
+		return a < std::numeric_limits<unsigned>::max() - b ? a + b + 1 : std::numeric_limits<unsigned>::max();
+	}
+
+	ExpressionP self() const
+	{
+		return std::const_pointer_cast<Expression>(shared_from_this());
 	}
 
+	// Lets go of part, a child of a node being destroyed. If that was the
+	// last reference, part is destroyed once the outermost such destructor
+	// on this thread returns to it, rather than inside this one, so that
+	// destroying a deep term does not recurse.
+	static void release(const ExpressionP &part);
+
 private:
-	std::string m_name;
+	const size_t m_hash;
+	const unsigned m_loose;
+	const unsigned m_size;
+	const unsigned m_depth;
+	const bool m_named;
 };
 
-std::ostream &operator<<(std::ostream &os, const ExpressionP& expr);
-
-class Function: public Expression
+class Name: public Expression
 {
 public:
-	static FunctionP create(const NameP vbound, const ExpressionP body)
+	static NameP create(const std::string &name)
 	{
-		return std::make_shared<Function>(vbound, body);
+		return create(Symbol::intern(name));
 	}
 
-	Function(const NameP vbound, const ExpressionP body):
-		m_vbound(vbound),
-		m_body(body)
+	static NameP create(Symbol name);
+	static size_t hashOf(Symbol name);
+
+	explicit Name(Symbol name):
+		Expression(hashOf(name), 0, true),
+		m_name(name) {}
+
+	bool operator==(const Name& other) const
 	{
-		auto fbody = std::dynamic_pointer_cast<Function>(m_body);
+		return this == &other;
 	}
 
-	FunctionP Aconvert(const NameP name) const
+	Symbol name() const
 	{
-		auto p = m_body->replace(m_vbound, name);
-		return create(name, p.second);
+		return m_name;
 	}
 
-	ExpressionP Breduce(const ExpressionP expr) const
+private:
+	const Symbol m_name;
+};
+
+// A variable bound by the index-th enclosing Function, counting from zero
+class Index: public Expression
+{
+public:
+	static IndexP create(unsigned index);
+	static size_t hashOf(unsigned index);
+
+	explicit Index(unsigned index):
+		Expression(hashOf(index), index + 1, false),
+		m_index(index) {}
+
+	unsigned index() const
 	{
-		auto p = m_body->replace(m_vbound, expr);
-		return p.second;
+		return m_index;
 	}
 
-	virtual std::pair<bool, ExpressionP> replace(const NameP name, const ExpressionP expr) const
+private:
+	const unsigned m_index;
+};
+
+// Printer::print in tree mode
+std::ostream &operator<<(std::ostream &os, const ExpressionP& expr);
+
+class Function: public Expression
+{
+public:
+	// Binds the free occurrences of vbound in body
+	static FunctionP create(const NameP vbound, const ExpressionP body)
 	{
-		auto p = std::dynamic_pointer_cast<Name>(expr);
-		if (p && *p == *m_vbound) {
-			// Not a very good scheme of alpha-conversion, has pathological cases!
-			return Aconvert(Name::create("^" + m_vbound->name()))->replace(name, expr);
-		} else {
-			if (*name == *m_vbound) {
-				return std::make_pair(false, create(m_vbound, m_body));
-			} else {
-				auto q = m_body->replace(name, expr);
-				return std::make_pair(q.first, create(m_vbound, q.second));
-			}
-		}
+		return fromIndexed(vbound, body->abstract(*vbound, 0));
 	}
 
-	virtual void print(std::ostream &os) const
+	// body already refers to the bound variable as index 0
+	static FunctionP fromIndexed(const NameP vbound, const ExpressionP body);
+	static size_t hashOf(const NameP vbound, const ExpressionP body);
+
+	Function(const NameP vbound, const ExpressionP body):
+		Expression(hashOf(vbound, body), body->loose() ? body->loose() - 1 : 0, body->named(),
+			grow(body->size(), 0), grow(body->depth(), 0)),
+		m_vbound(vbound),
+		m_body(body) {}
+
+	ExpressionP Breduce(const ExpressionP expr) const
 	{
-		os << "λ";
-		m_vbound->print(os);
-		os << ".";
-		m_body->print(os);
+		Stats::beta();
+		return m_body->substitute(0, expr);
 	}
 
+	~Function();
+
 	const ExpressionP body() const
 	{
 		return m_body;
 	}
 
+	// The name the bound variable was written with
 	const NameP vbound() const
 	{
 		return m_vbound;
@@ -141,29 +224,16 @@ private:
 class Application: public Expression
 {
 public:
-	static ApplicationP create(const ExpressionP func, const ExpressionP arg)
-	{
-		return std::make_shared<Application>(func, arg);
-	}
+	static ApplicationP create(const ExpressionP func, const ExpressionP arg);
+	static size_t hashOf(const ExpressionP func, const ExpressionP arg);
 
 	Application(const ExpressionP func, const ExpressionP arg):
+		Expression(hashOf(func, arg), std::max(func->loose(), arg->loose()), func->named() || arg->named(),
+			grow(func->size(), arg->size()), grow(std::max(func->depth(), arg->depth()), 0)),
 		m_func(func),
 		m_arg(arg) {}
 
-	virtual std::pair<bool, ExpressionP> replace(const NameP name, const ExpressionP expr) const
-	{
-		auto p = m_func->replace(name, expr);
-		auto q = m_arg->replace(name, expr);
-		return std::make_pair(p.first || q.first, create(p.second, q.second));
-	}
-
-	virtual void print(std::ostream &os) const
-	{
-		os << "(" << m_func;
-		os << " ";
-		m_arg->print(os);
-		os << ")";
-	}
+	~Application();
 
 	ExpressionP apply() const
 	{
@@ -190,433 +260,135 @@ private:
 	const ExpressionP m_arg;
 };
 
+// A natural number, standing for builtin_succ applied that many times to
+// builtin_zero and printed as the normal form of that
+class Numeral: public Expression
+{
+public:
+	static NumeralP create(unsigned long value);
+	static size_t hashOf(unsigned long value);
+
+	explicit Numeral(unsigned long value):
+		Expression(hashOf(value), 0, false),
+		m_value(value) {}
+
+	// λx.x for zero, otherwise λs.((s false) n) with n the numeral one less.
+	// A numeral applied to an argument is replaced by this first.
+	ExpressionP unfold() const;
+
+	unsigned long value() const
+	{
+		return m_value;
+	}
+
+private:
+	const unsigned long m_value;
+};
+
+// A builtin on numerals. Applied to arity() numerals it is replaced by its
+// result in one step; applied to anything else it stands for definition(), the
+// lambda term it computes the same thing as.
+class Primitive: public Expression
+{
+public:
+	enum class Op {
+		SUCC,
+		PRED,
+		ISZERO,
+		ADD,
+		SUB,
+		MULT,
+		EQUAL
+	};
+
+	static PrimitiveP create(Op op);
+	static size_t hashOf(Op op);
+
+	explicit Primitive(Op op):
+		Expression(hashOf(op), 0, false),
+		m_op(op) {}
+
+	unsigned arity() const;
+	ExpressionP definition() const;
+
+	// Whether the definition leaves its argument unevaluated, as that of
+	// builtin_succ does. Such a primitive only takes a delta step on an
+	// argument that is a numeral already, and is replaced by its definition
+	// on anything else.
+	bool lazy() const;
+
+	// Whether the result for the values of arity() numerals, first argument
+	// first, is a numeral too large to hold, which leaves the definition to
+	// work it out
+	bool overflows(const std::vector<unsigned long> &args) const;
+
+	// The result for the values of arity() numerals, first argument first,
+	// null if it overflows
+	ExpressionP apply(const std::vector<unsigned long> &args) const;
+
+	// The builtin_ name the parser knows it by
+	const char *name() const;
+
+	Op op() const
+	{
+		return m_op;
+	}
+
+private:
+	const Op m_op;
+};
+
+// The innermost function of the applications along the left of expr, and how
+// many arguments it is applied to
+const Expression *head(const Expression &expr, unsigned &args);
+
+// The primitive heading expr if expr applies it to exactly arity() arguments
+const Primitive *saturated(const Expression &expr);
+
+// head if it is a primitive that args arguments saturate
+const Primitive *saturated(const Expression &head, unsigned args);
+
+// Whether expr has no redex at its head
+bool weakHeadNormal(const Expression &expr);
+
 ExpressionP Nreduce1(const ExpressionP expr);
 ExpressionP Areduce1(const ExpressionP expr);
 
-ExpressionP reduce(ExpressionP expr);
-
-namespace Expressions {
-
-// λx.x
-const auto zero =
-	Function::create(
-		Name::create("x"),
-		Name::create("x")
-	);
-
-// λx.λy.x
-const auto select_first =
-	Function::create(
-		Name::create("x"),
-		Function::create(
-			Name::create("y"),
-			Name::create("x")
-		)
-	);
-
-// λx.λy.y
-const auto select_second =
-	Function::create(
-		Name::create("x"),
-		Function::create(
-			Name::create("y"),
-			Name::create("y")
-		)
-	);
-
-const auto true_func = select_first;
-const auto false_func = select_second;
-
-// λe1.λe2.λc.((c e1) e2)
-const auto cond =
-	Function::create(
-		Name::create("e1"),
-		Function::create(
-			Name::create("e2"),
-			Function::create(
-				Name::create("c"),
-				Application::create(
-					Application::create(
-						Name::create("c"),
-						Name::create("e1")
-					),
-					Name::create("e2")
-				)
-			)
-		)
-	);
-
-const auto make_pair = cond;
-
-// λn.(n select_first)
-const auto iszero =
-	Function::create(
-		Name::create("n"),
-		Application::create(
-			Name::create("n"),
-			select_first
-		)
-	);
-
-// λn.λs.((s false) n)
-const auto succ =
-	Function::create(
-		Name::create("n"),
-		Function::create(
-			Name::create("s"),
-			Application::create(
-				Application::create(
-					Name::create("s"),
-					false_func
-				),
-				Name::create("n")
-			)
-		)
-	);
-
-const auto one =
-	Application::create(
-		succ,
-		zero
-	);
-
-// λn.if iszero n then zero else (n select_second)
-const auto pred =
-	Function::create(
-		Name::create("n"),
-		Application::create(
-			Application::create(
-				Application::create(
-					cond,
-					Application::create(
-						iszero,
-						Name::create("n")
-					)
-				),
-				zero
-			),
-			Application::create(
-				Name::create("n"),
-				select_second
-			)
-		)
-	);
-
-// λs.(f (s s)
-const auto rec1 =
-	Function::create(
-		Name::create("s"),
-		Application::create(
-			Name::create("f"),
-			Application::create(
-				Name::create("s"),
-				Name::create("s")
-			)
-		)
-	);
-
-// λf.(λs.(f (s s)) λs.(f (s s)))
-const auto recursive =
-	Function::create(
-		Name::create("f"),
-		Application::create(
-			rec1,
-			rec1
-		)
-	);
-
-// λf.λx.λy.if iszero x then y else ((f pred x) succ y)
-const auto add1 =
-	Function::create(
-		Name::create("f"),
-		Function::create(
-			Name::create("x"),
-			Function::create(
-				Name::create("y"),
-				Application::create(
-					Application::create(
-						Application::create(
-							cond,
-							// then
-							Name::create("y")
-						),
-						// else
-						Application::create(
-							Application::create(
-								Name::create("f"),
-								Application::create(
-									pred,
-									Name::create("x")
-								)
-							),
-							Application::create(
-								succ,
-								Name::create("y")
-							)
-						)
-					),
-					// cond
-					Application::create(
-						iszero,
-						Name::create("x")
-					)
-				)
-			)
-		)
-	);
-
-// (recursive add1)
-const auto add =
-	Application::create(
-		recursive,
-		add1
-	);
-
-// λf.λx.λy.if iszero y then x else ((f pred x) pred y)
-const auto sub1 =
-	Function::create(
-		Name::create("f"),
-		Function::create(
-			Name::create("x"),
-			Function::create(
-				Name::create("y"),
-				Application::create(
-					Application::create(
-						Application::create(
-							cond,
-							// then
-							Name::create("x")
-						),
-						// else
-						Application::create(
-							Application::create(
-								Name::create("f"),
-								Application::create(
-									pred,
-									Name::create("x")
-								)
-							),
-							Application::create(
-								pred,
-								Name::create("y")
-							)
-						)
-					),
-					// cond
-					Application::create(
-						iszero,
-						Name::create("y")
-					)
-				)
-			)
-		)
-	);
-
-// (recursive sub1)
-const auto sub =
-	Application::create(
-		recursive,
-		sub1
-	);
-
-// λx.λy.add sub x y sub y x
-const auto abs_diff =
-	Function::create(
-		Name::create("x"),
-		Function::create(
-			Name::create("y"),
-			Application::create(
-				Application::create(
-					add,
-					Application::create(
-						Application::create(
-							sub,
-							Name::create("x")
-						),
-						Name::create("y")
-					)
-				),
-				Application::create(
-					Application::create(
-						sub,
-						Name::create("y")
-					),
-					Name::create("x")
-				)
-			)
-		)
-	);
-
-const auto equal =
-	Function::create(
-		Name::create("x"),
-		Function::create(
-			Name::create("y"),
-			Application::create(
-				iszero,
-				Application::create(
-					Application::create(
-						abs_diff,
-						Name::create("x")
-					),
-					Name::create("y")
-				)
-			)
-		)
-	);
-
-const auto make_obj = make_pair;
-
-const auto type_func =
-	Function::create(
-		Name::create("obj"),
-		Application::create(
-			Name::create("obj"),
-			select_first
-		)
-	);
-
-const auto value_func =
-	Function::create(
-		Name::create("obj"),
-		Application::create(
-			Name::create("obj"),
-			select_second
-		)
-	);
-
-const auto istype =
-	Function::create(
-		Name::create("t"),
-		Function::create(
-			Name::create("obj"),
-			Application::create(
-				Application::create(
-					equal,
-					Name::create("t")
-				),
-				Application::create(
-					type_func,
-					Name::create("obj")
-				)
-			)
-		)
-	);
-
-const auto error_type = zero;
-
-const auto make_error =
-	Application::create(
-		make_obj,
-		error_type
-	);
-
-const auto bool_type = one;
-
-const auto isbool =
-	Function::create(
-		Name::create("x"),
-		Application::create(
-			Application::create(
-				istype,
-				bool_type
-			),
-			Name::create("x")
-		)
-	);
-
-const auto bool_error =
-	Application::create(
-		make_error,
-		bool_type
-	);
-
-#if 0
-const auto typed_cond =
-	Function::create(
-		Name::create("E1"),
-		Function::create(
-			Name::create("E2"),
-			Function::create(
-				Name::create("C"),
-				Application::create(
-					Application::create(
-						Application::create(
-							cond,
-							// then
-							Application::create(
-								Application::create(
-									Application::create(
-										cond,
-										//then
-										Name::create("E1")
-									),
-									// else
-									Name::create("E2")
-								),
-								// cond
-								Application::create(
-									value_func,
-									Name::create("C")
-								)
-							)
-						),
-						// else
-						bool_error
-					),
-					// cond
-					Application::create(
-						isbool,
-						Name::create("C")
-					)
-				)
-			)
-		)
-	);
-#endif
-
-const auto typed_cond =
-	Function::create(
-		Name::create("E1"),
-		Function::create(
-			Name::create("E2"),
-			Function::create(
-				Name::create("C"),
-				Application::create(
-					Application::create(
-						Application::create(
-							cond,
-							// then
-							Application::create(
-								Application::create(
-									Application::create(
-										cond,
-										//then
-										Name::create("E1")
-									),
-									// else
-									Name::create("E2")
-								),
-								// cond
-								Application::create(
-									value_func,
-									Name::create("C")
-								)
-							)
-						),
-						// else
-						bool_error
-					),
-					// cond
-					Application::create(
-						isbool,
-						Name::create("C")
-					)
-				)
-			)
-		)
-	);
-
-} // namespace Expressions
+// One step at the root of expr that is not a beta step: an applied Numeral
+// unfolded, or a saturated Primitive given its result, replaced by its
+// definition when an argument is a weak head normal form other than a
+// numeral, when it is lazy and an argument is not a numeral, or when the
+// result overflows, or else with the rightmost argument that is neither
+// reduced one Nreduce1 step. Null if expr is neither.
+ExpressionP Dreduce1(const ExpressionP expr);
+
+// Dreduce1 given saturated(*expr), for a caller that already knows it
+ExpressionP Dreduce1(const ExpressionP expr, const Primitive *prim);
+
+// Ways reduce() can arrive at a normal form
+enum class Engine {
+	// Repeated Areduce1
+	APPLICATIVE,
+	// Repeated Nreduce1
+	NORMAL,
+	// Krivine::normalize
+	KRIVINE,
+	// Lazy::normalize
+	LAZY,
+	// Zipper steps, the same as NORMAL
+	ZIPPER,
+	// NbE::normalize
+	NBE,
+	// VM::normalize
+	VM,
+	// Optimal::normalize
+	OPTIMAL,
+	// Krivine::normalize on Pool::shared()
+	PARALLEL
+};
+
+// The normal form of expr. With a Trace::Scope in force APPLICATIVE, NORMAL
+// and ZIPPER write down every step they take.
+ExpressionP reduce(ExpressionP expr, Engine engine=Engine::APPLICATIVE);
 
 } // namespace Lambda
@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <vector>
+
+#include "budget.h"
+#include "lazy.h"
+#include "region.h"
+
+using std::shared_ptr;
+using std::vector;
+
+namespace Lambda {
+namespace Lazy {
+
+namespace {
+
+struct Thunk;
+using ThunkP = shared_ptr<Thunk>;
+
+struct Env;
+using EnvP = shared_ptr<const Env>;
+
+struct Env
+{
+	Env(const ThunkP &value, const EnvP &next):
+		value(value),
+		next(next) {}
+
+	const ThunkP value;
+	const EnvP next;
+};
+
+// An argument shared by every variable bound to it. It starts out as a term in
+// its environment and is updated in place once evaluated: either to an
+// abstraction in its environment or a numeral, or to a variable applied to
+// further thunks.
+struct Thunk
+{
+	enum class State {
+		DELAYED,
+		FUNCTION,
+		NEUTRAL
+	};
+
+	Thunk(const ExpressionP &term, const EnvP &env, unsigned depth):
+		state(State::DELAYED),
+		term(term),
+		env(env),
+		level(0),
+		depth(depth),
+		normalDepth(0) {}
+
+	// The variable of the binder at level
+	explicit Thunk(unsigned level):
+		state(State::NEUTRAL),
+		level(level),
+		depth(level + 1),
+		normalDepth(0) {}
+
+	State state;
+
+	// DELAYED and FUNCTION
+	ExpressionP term;
+	EnvP env;
+
+	// NEUTRAL: a free Name, or else the variable at level, applied to args
+	ExpressionP name;
+	unsigned level;
+	vector<ThunkP> args;
+
+	// Binders gone under when the thunk was made. The variables it refers to
+	// are all bound above that, but not always above every depth it is read
+	// back at: a thunk made while evaluating another's term gets the depth of
+	// the evaluation rather than that of the other thunk.
+	const unsigned depth;
+
+	// The normal form once it has been read back, at the least depth it has
+	// been read at
+	ExpressionP normal;
+	unsigned normalDepth;
+};
+
+// An argument, or the thunk to update with the weak head normal form reached
+struct Frame
+{
+	ThunkP thunk;
+	bool update;
+};
+
+EnvP bind(const ThunkP &value, const EnvP &next)
+{
+	return makeShared<Env>(value, next);
+}
+
+const ThunkP &lookup(const Env *env, unsigned index)
+{
+	for (; index > 0; --index) {
+		env = env->next.get();
+	}
+	return env->value;
+}
+
+ThunkP argument(const ExpressionP &arg, const EnvP &env, unsigned depth)
+{
+	// A variable passes on the thunk it is bound to rather than a new one
+	if (auto index = dynamic_cast<const Index *>(arg.get())) {
+		return lookup(env.get(), index->index());
+	}
+	return makeShared<Thunk>(arg, env, depth);
+}
+
+ExpressionP normalize(const ThunkP &thunk, unsigned depth);
+
+// A free Name, or else the variable at level, applied to args
+struct Neutral
+{
+	ExpressionP name;
+	unsigned level;
+	vector<ThunkP> args;
+};
+
+bool whnf(ExpressionP &term, EnvP &env, vector<Frame> &stack, unsigned depth, Neutral &head);
+
+// Evaluates thunk if that has not been done yet
+void force(const ThunkP &thunk)
+{
+	if (thunk->state == Thunk::State::DELAYED) {
+		ExpressionP term = Index::create(0);
+		auto env = bind(thunk, nullptr);
+		vector<Frame> stack;
+		Neutral head;
+		whnf(term, env, stack, thunk->depth, head);
+	}
+}
+
+// Replaces a primitive applied to the arguments on stack by its result, false
+// if it is short of arguments, one of them is not a numeral or the result
+// overflows
+bool delta(const Primitive &prim, ExpressionP &term, EnvP &env, vector<Frame> &stack)
+{
+	auto arity = prim.arity();
+	if (stack.size() < arity) {
+		return false;
+	}
+	for (unsigned i = 0; i < arity; ++i) {
+		if (stack[stack.size() - 1 - i].update) {
+			return false;
+		}
+	}
+
+	// The last argument is evaluated first
+	vector<unsigned long> values(arity);
+	for (unsigned i = arity; i-- > 0;) {
+		auto &thunk = stack[stack.size() - 1 - i].thunk;
+		if (!prim.lazy()) {
+			force(thunk);
+		}
+		auto num = dynamic_cast<const Numeral *>(thunk->term.get());
+		if (thunk->state == Thunk::State::NEUTRAL || !num) {
+			return false;
+		}
+		values[i] = num->value();
+	}
+
+	auto result = prim.apply(values);
+	if (!result) {
+		return false;
+	}
+	stack.resize(stack.size() - arity);
+	term = result;
+	env = nullptr;
+	return true;
+}
+
+// Runs the machine on term in env until it is an abstraction or a numeral with
+// no arguments or thunks to update left, updating the thunks it evaluates on
+// the way. Returns true instead if it gets stuck on a variable, which is then
+// in head along with its arguments. depth is the number of binders gone under
+// to reach term.
+bool whnf(ExpressionP &term, EnvP &env, vector<Frame> &stack, unsigned depth, Neutral &head)
+{
+	while (true) {
+		Budget::step();
+		if (auto app = dynamic_cast<const Application *>(term.get())) {
+			stack.push_back(Frame{argument(app->arg(), env, depth), false});
+			term = app->func();
+		} else if (auto func = dynamic_cast<const Function *>(term.get())) {
+			if (stack.empty()) {
+				return false;
+			} else if (stack.back().update) {
+				auto &thunk = *stack.back().thunk;
+				thunk.state = Thunk::State::FUNCTION;
+				thunk.term = term;
+				thunk.env = env;
+				stack.pop_back();
+			} else {
+				Stats::beta();
+				env = bind(stack.back().thunk, env);
+				stack.pop_back();
+				term = func->body();
+			}
+		} else if (auto index = dynamic_cast<const Index *>(term.get())) {
+			auto thunk = lookup(env.get(), index->index());
+			if (thunk->state == Thunk::State::DELAYED) {
+				stack.push_back(Frame{thunk, true});
+				term = thunk->term;
+				env = thunk->env;
+			} else if (thunk->state == Thunk::State::FUNCTION) {
+				term = thunk->term;
+				env = thunk->env;
+			} else {
+				for (auto it = thunk->args.rbegin(); it != thunk->args.rend(); ++it) {
+					stack.push_back(Frame{*it, false});
+				}
+				head.name = thunk->name;
+				head.level = thunk->level;
+				break;
+			}
+		} else if (auto num = dynamic_cast<const Numeral *>(term.get())) {
+			if (stack.empty()) {
+				return false;
+			} else if (stack.back().update) {
+				// Kept as it is, like an abstraction
+				auto &thunk = *stack.back().thunk;
+				thunk.state = Thunk::State::FUNCTION;
+				thunk.term = term;
+				thunk.env = nullptr;
+				stack.pop_back();
+			} else {
+				term = num->unfold();
+				env = nullptr;
+			}
+		} else if (auto prim = dynamic_cast<const Primitive *>(term.get())) {
+			if (!delta(*prim, term, env, stack)) {
+				term = prim->definition();
+				env = nullptr;
+			}
+		} else {
+			head.name = term;
+			head.level = 0;
+			break;
+		}
+	}
+
+	// Stuck on a variable: every thunk being evaluated is that variable applied
+	// to the arguments above it
+	head.args.clear();
+	while (!stack.empty()) {
+		auto frame = stack.back();
+		stack.pop_back();
+		if (frame.update) {
+			auto &thunk = *frame.thunk;
+			thunk.state = Thunk::State::NEUTRAL;
+			thunk.term = nullptr;
+			thunk.env = nullptr;
+			thunk.name = head.name;
+			thunk.level = head.level;
+			thunk.args = head.args;
+		} else {
+			head.args.push_back(frame.thunk);
+		}
+	}
+	return true;
+}
+
+ExpressionP normalize(ExpressionP term, EnvP env, unsigned depth)
+{
+	vector<Frame> stack;
+	Neutral head;
+
+	if (!whnf(term, env, stack, depth, head)) {
+		auto func = dynamic_cast<const Function *>(term.get());
+		if (!func) {
+			// A numeral is already in normal form
+			return term;
+		}
+		auto var = makeShared<Thunk>(depth);
+		auto body = normalize(func->body(), bind(var, env), depth + 1);
+		return Function::fromIndexed(func->vbound(), body);
+	}
+
+	ExpressionP result = head.name ? head.name : Index::create(depth - 1 - head.level);
+	for (auto &arg: head.args) {
+		result = Application::create(result, normalize(arg, depth));
+	}
+	return result;
+}
+
+ExpressionP normalize(const ThunkP &thunk, unsigned depth)
+{
+	// Indices can only be raised, so a read at a lesser depth than the one
+	// kept reads the thunk back again there
+	auto at = std::min(depth, thunk->depth);
+	if (!thunk->normal || at < thunk->normalDepth) {
+		thunk->normal = normalize(Index::create(0), bind(thunk, nullptr), at);
+		thunk->normalDepth = at;
+	}
+	return thunk->normal->shift(depth - thunk->normalDepth, 0);
+}
+
+} // namespace
+
+ExpressionP normalize(const ExpressionP expr)
+{
+	return normalize(expr, nullptr, 0);
+}
+
+} // namespace Lazy
+} // namespace Lambda
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "lambda.h"
+
+namespace Lambda {
+namespace Lazy {
+
+// Normal form of expr under call-by-need. Arguments are passed as shared
+// thunks that are overwritten with their weak head normal form the first time
+// they are evaluated and remember their normal form once it has been read
+// back, so a redex inside an argument is reduced at most once however many
+// times the bound variable occurs. The result is the same as repeated Nreduce1.
+ExpressionP normalize(const ExpressionP expr);
+
+} // namespace Lazy
+} // namespace Lambda
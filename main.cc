@@ -1,105 +1,560 @@
 #include <array>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <deque>
 #include <fstream>
 #include <ios>
 #include <iostream>
-#include <locale>
+#include <map>
+#include <memory>
 #include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 
+#include "budget.h"
+#include "concurrent.h"
+#include "image.h"
 #include "lambda.h"
+#include "memo.h"
 #include "parser.h"
+#include "pool.h"
+#include "printer.h"
+#include "region.h"
+#include "source.h"
+#include "stats.h"
+#include "trace.h"
 
 using std::cerr;
+using std::deque;
 using std::cout;
 using std::endl;
-using std::getline;
-using std::locale;
 using std::make_shared;
-using std::wcout;
-using std::wifstream;
-using std::wstring;
+using std::map;
+using std::ostringstream;
+using std::runtime_error;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using std::chrono::duration;
+using std::chrono::steady_clock;
 
 using boost::filesystem::exists;
 
+namespace Stats = Lambda::Stats;
+namespace Trace = Lambda::Trace;
+
+using Lambda::Budget;
+using Lambda::BudgetExceeded;
+using Lambda::BudgetScope;
+using Lambda::CancelToken;
+using Lambda::ConcurrentScope;
+using Lambda::Engine;
 using Lambda::ExpressionP;
-using Lambda::Nreduce1;
-using Lambda::Areduce1;
+using Lambda::Limits;
+using Lambda::Pool;
+using Lambda::Printer;
+using Lambda::Region;
+using Lambda::RegionScope;
+using Lambda::reduce;
 using Lambda::Parser::ExpressionBuilder;
 using Lambda::Parser::newDefaultSymTable;
 
+namespace {
+
+const map<string, Engine> &engines()
+{
+	const static map<string, Engine> names = {
+		{"applicative", Engine::APPLICATIVE},
+		{"normal", Engine::NORMAL},
+		{"krivine", Engine::KRIVINE},
+		{"lazy", Engine::LAZY},
+		{"nbe", Engine::NBE},
+		{"optimal", Engine::OPTIMAL},
+		{"parallel", Engine::PARALLEL},
+		{"vm", Engine::VM},
+		{"zipper", Engine::ZIPPER}
+	};
+
+	return names;
+}
+
+// Cancelled by the first interrupt, which stops the run after printing how far
+// the evaluations in progress got. A second one ends it at once.
+CancelToken g_interrupt;
+
+void interrupted(int)
+{
+	g_interrupt.cancel();
+	std::signal(SIGINT, SIG_DFL);
+}
+
+// How every Eval line is reduced
+struct Options
+{
+	Engine engine;
+	Limits limits;
+	// Whether to print the statistics of each evaluation on stderr
+	bool stats;
+	// Whether results bind their repeated subterms with let
+	bool shared;
+	// Where to write down the steps of each evaluation, if anywhere
+	Trace::Writer *trace;
+};
+
+string engineName(Engine engine)
+{
+	for (auto &name: engines()) {
+		if (name.second == engine) {
+			return name.first;
+		}
+	}
+	return string{};
+}
+
+const char *limitName(BudgetExceeded::Limit limit)
+{
+	switch (limit) {
+	case BudgetExceeded::Limit::STEPS:
+		return "steps";
+	case BudgetExceeded::Limit::NODES:
+		return "nodes";
+	case BudgetExceeded::Limit::BYTES:
+		return "bytes";
+	case BudgetExceeded::Limit::TIME:
+		return "time";
+	case BudgetExceeded::Limit::CANCELLED:
+		return "cancelled";
+	}
+	return "";
+}
+
+// An Eval line reduced, and what that took
+struct Outcome
+{
+	// What to print after "... "
+	string result;
+	// "ok", or the limit that stopped it before it reached a normal form
+	string status;
+	double seconds;
+	unsigned long steps;
+	Stats::Counters counters;
+	size_t peak_bytes;
+	// Of the normal form, if it got there
+	unsigned size;
+	unsigned depth;
+};
+
+Outcome evaluate(const ExpressionP expr, const Options &options, const string &source)
+{
+	Outcome outcome{string{}, "ok", 0, 0, Stats::Counters{}, 0, 0, 0};
+
+	// Released along with the last node of the evaluation
+	RegionScope scope;
+	Budget budget(options.limits, &g_interrupt);
+	{
+		BudgetScope in_force(&budget);
+		Stats::Scope counting(&outcome.counters);
+		Trace::Scope tracing(options.trace, options.trace ? source : string{});
+
+		ostringstream os;
+		auto start = steady_clock::now();
+		try {
+			auto normal = reduce(expr, options.engine);
+			outcome.seconds = duration<double>(steady_clock::now() - start).count();
+			outcome.size = normal->size();
+			outcome.depth = normal->depth();
+			os << "=> ";
+			Printer(os, options.shared ? Printer::Mode::SHARED : Printer::Mode::TREE).print(normal);
+		} catch (const BudgetExceeded &e) {
+			outcome.seconds = duration<double>(steady_clock::now() - start).count();
+			outcome.status = limitName(e.limit());
+			os << "!! " << e.what();
+		}
+		outcome.result = os.str();
+	}
+	outcome.steps = budget.progress().steps;
+	outcome.peak_bytes = Region::current()->peak();
+	return outcome;
+}
+
+string jsonString(const string &text)
+{
+	ostringstream os;
+	os << '"';
+	for (auto c: text) {
+		if (c == '"' || c == '\\') {
+			os << '\\' << c;
+		} else if (static_cast<unsigned char>(c) < 0x20) {
+			os << "\\u00" << "0123456789abcdef"[c >> 4] << "0123456789abcdef"[c & 0xf];
+		} else {
+			os << c;
+		}
+	}
+	os << '"';
+	return os.str();
+}
+
+// The statistics of an evaluation as a line of JSON
+string statsLine(const string &source, const Options &options, double parse_seconds, const Outcome &outcome)
+{
+	static const char *const kinds[Stats::NODE_KINDS] = {
+		"name", "index", "function", "application", "numeral", "primitive"
+	};
+
+	auto &counters = outcome.counters;
+	ostringstream os;
+	os << "{\"expression\":" << jsonString(source);
+	os << ",\"engine\":\"" << engineName(options.engine) << "\"";
+	os << ",\"status\":\"" << outcome.status << "\"";
+	os << ",\"parse_ms\":" << parse_seconds * 1000 << ",\"eval_ms\":" << outcome.seconds * 1000;
+	os << ",\"steps\":" << outcome.steps << ",\"beta\":" << counters.beta << ",\"delta\":" << counters.delta;
+	os << ",\"renames\":" << counters.renames << ",\"nodes\":{";
+	for (unsigned i = 0; i < Stats::NODE_KINDS; ++i) {
+		os << (i ? "," : "") << "\"" << kinds[i] << "\":" << counters.nodes[i];
+	}
+	os << "},\"max_size\":" << counters.max_size << ",\"max_depth\":" << counters.max_depth;
+	if (outcome.status == "ok") {
+		os << ",\"result_size\":" << outcome.size << ",\"result_depth\":" << outcome.depth;
+	}
+	os << ",\"peak_bytes\":" << outcome.peak_bytes << "}";
+	return os.str();
+}
+
+// An Eval line reduced on the pool, its result kept as text
+class Evaluation: public Pool::Task
+{
+public:
+	Evaluation(const ExpressionP expr, const Options &options, const string &source, double parse_seconds):
+		m_expr(expr),
+		m_options(options),
+		m_source(source),
+		m_parse_seconds(parse_seconds) {}
+
+	// Prints the line and, once it is done, its result
+	void print(Pool &pool)
+	{
+		cout << "---" << endl;
+		cout << "Eval \"" << m_source << "\"" << endl;
+		pool.join(*this);
+		cout << "... " << m_outcome.result << endl;
+		if (m_options.stats) {
+			cerr << statsLine(m_source, m_options, m_parse_seconds, m_outcome) << endl;
+		}
+	}
+
+	// Whether the budget ran out, once done
+	bool exceeded() const
+	{
+		return m_outcome.status != "ok";
+	}
+
+protected:
+	virtual void run()
+	{
+		m_outcome = evaluate(m_expr, m_options, m_source);
+		m_expr = nullptr;
+	}
+
+private:
+	ExpressionP m_expr;
+	const Options m_options;
+	const string m_source;
+	const double m_parse_seconds;
+	Outcome m_outcome;
+};
+
+// The output of --batch. Eval lines are handed to the pool as they are read,
+// and everything is printed in source order as soon as what comes before it
+// has been.
+class Batch
+{
+public:
+	Batch(Pool &pool, const Options &options):
+		m_pool(pool),
+		m_options(options),
+		m_exceeded(false) {}
+
+	~Batch()
+	{
+		// The pool refers to the evaluations until they are done
+		for (auto &entry: m_entries) {
+			if (entry.evaluation) {
+				try {
+					m_pool.join(*entry.evaluation);
+				} catch (...) {}
+			}
+		}
+	}
+
+	Batch(const Batch &) = delete;
+	Batch &operator=(const Batch &) = delete;
+
+	void text(const string &text)
+	{
+		m_entries.push_back(Entry{text, nullptr});
+		flush(false);
+	}
+
+	void eval(const ExpressionP expr, const string &source, double parse_seconds)
+	{
+		m_entries.push_back(Entry{string{}, unique_ptr<Evaluation>(new Evaluation(expr, m_options, source, parse_seconds))});
+		m_pool.spawn(*m_entries.back().evaluation);
+		flush(false);
+	}
+
+	// Prints the entries at the front that are done, or every entry if wait
+	void flush(bool wait)
+	{
+		while (!m_entries.empty()) {
+			auto &entry = m_entries.front();
+			if (!entry.evaluation) {
+				cout << entry.text;
+			} else if (wait || entry.evaluation->done()) {
+				entry.evaluation->print(m_pool);
+				m_exceeded = m_exceeded || entry.evaluation->exceeded();
+			} else {
+				break;
+			}
+			m_entries.pop_front();
+		}
+	}
+
+	// Whether an evaluation printed so far ran out of budget
+	bool exceeded() const
+	{
+		return m_exceeded;
+	}
+
+private:
+	struct Entry
+	{
+		string text;
+		unique_ptr<Evaluation> evaluation;
+	};
+
+	Pool &m_pool;
+	const Options m_options;
+	deque<Entry> m_entries;
+	bool m_exceeded;
+};
+
+} // namespace
+
 int main(int argc, char *argv[])
 {
-	wcout.imbue(locale("en_US.UTF-8"));
+	Options options{Engine::KRIVINE, Limits{}, false, false, nullptr};
+	auto batch_mode = false;
+	string trace_file;
+	unsigned long trace_every = 1000;
+	string load_image;
+	string save_image;
+	vector<string> files;
+
+	for(int i=1; i<argc; ++i) {
+		string arg{argv[i]};
+		if (arg.compare(0, 9, "--engine=") == 0) {
+			auto it = engines().find(arg.substr(9));
+			if (it == engines().end()) {
+				cerr << "Unknown engine \"" << arg.substr(9) << "\"" << endl;
+				return 1;
+			}
+			options.engine = it->second;
+		} else if (arg.compare(0, 10, "--threads=") == 0) {
+			auto threads = std::atoi(arg.c_str() + 10);
+			if (threads < 1) {
+				cerr << "Bad thread count \"" << arg.substr(10) << "\"" << endl;
+				return 1;
+			}
+			Lambda::Pool::setThreads(threads);
+		} else if (arg.compare(0, 7, "--memo=") == 0) {
+			auto capacity = std::atol(arg.c_str() + 7);
+			if (capacity < 1) {
+				cerr << "Bad memo size \"" << arg.substr(7) << "\"" << endl;
+				return 1;
+			}
+			Lambda::Memo::enable(capacity);
+		} else if (arg.compare(0, 12, "--max-steps=") == 0) {
+			options.limits.steps = std::strtoul(arg.c_str() + 12, nullptr, 10);
+		} else if (arg.compare(0, 12, "--max-nodes=") == 0) {
+			options.limits.nodes = std::strtoul(arg.c_str() + 12, nullptr, 10);
+		} else if (arg.compare(0, 12, "--max-bytes=") == 0) {
+			options.limits.bytes = std::strtoul(arg.c_str() + 12, nullptr, 10);
+		} else if (arg.compare(0, 10, "--timeout=") == 0) {
+			options.limits.time = std::chrono::milliseconds(std::strtoul(arg.c_str() + 10, nullptr, 10));
+		} else if (arg.compare(0, 8, "--trace=") == 0) {
+			trace_file = arg.substr(8);
+		} else if (arg.compare(0, 14, "--trace-every=") == 0) {
+			trace_every = std::strtoul(arg.c_str() + 14, nullptr, 10);
+		} else if (arg == "--stats") {
+			options.stats = true;
+		} else if (arg == "--print-shared") {
+			options.shared = true;
+		} else if (arg == "--batch") {
+			batch_mode = true;
+		} else if (arg.compare(0, 13, "--load-image=") == 0) {
+			load_image = arg.substr(13);
+		} else if (arg.compare(0, 13, "--save-image=") == 0) {
+			save_image = arg.substr(13);
+		} else if (arg.compare(0, 2, "--") == 0) {
+			cerr << "Unknown option \"" << arg << "\"" << endl;
+			return 1;
+		} else {
+			files.push_back(arg);
+		}
+	}
 
-	if (argc == 1) {
+	if (files.empty() && save_image.empty()) {
 		cerr << "REPL not yet implemented" << endl;
 		return 1;
 	}
 
-	auto syms = newDefaultSymTable();
-
-	for(int i=1; i<argc; ++i) {
-		if (!exists(argv[i])) {
-			cerr << "File \"" << argv[i] << "\" does not exist" << endl;
+	// Only the engines that rewrite the term one step at a time can say where
+	// each step was taken, and one file is written from one thread
+	unique_ptr<Trace::Writer> trace;
+	if (!trace_file.empty()) {
+		if (options.engine != Engine::NORMAL && options.engine != Engine::APPLICATIVE && options.engine != Engine::ZIPPER) {
+			cerr << "--trace needs the normal, applicative or zipper engine" << endl;
+			return 1;
+		}
+		if (batch_mode || Lambda::Memo::enabled()) {
+			cerr << "--trace goes with neither --batch nor --memo" << endl;
 			return 1;
 		}
+		trace.reset(new Trace::Writer(trace_file, trace_every));
+		if (!*trace) {
+			cerr << "Cannot write to \"" << trace_file << "\"" << endl;
+			return 1;
+		}
+		options.trace = trace.get();
+	}
 
-		wifstream wfs{};
-		wfs.imbue(locale("en_US.UTF-8"));
-		wfs.open(argv[i]);
+	auto syms = newDefaultSymTable();
+	if (!load_image.empty()) {
+		try {
+			syms = Lambda::Image::load(load_image);
+		} catch (const runtime_error &e) {
+			cerr << e.what() << endl;
+			return 1;
+		}
+	}
 
-		do {
-			wstring ws{};
+	std::signal(SIGINT, interrupted);
 
-			do {
-				wstring line{};
-				getline(wfs, line);
-				line = line.substr(0, line.find(L"--"));
-				auto pos = line.find_first_of(L'\\');
-				if (pos == wstring::npos) {
-					ws += line;
-					break;
-				} else {
-					ws += line.substr(0, pos);
-				}
-			} while (true);
+	// The pool reduces while the definitions after an Eval are parsed here,
+	// so the tables are shared until the batch is done
+	unique_ptr<ConcurrentScope> concurrent;
+	unique_ptr<Batch> batch;
+	if (batch_mode) {
+		concurrent.reset(new ConcurrentScope);
+		batch.reset(new Batch(Pool::shared(), options));
+	}
 
-			if (wfs.eof() || wfs.bad()) {
-				break;
+	auto exceeded = false;
+	for(auto &file: files) {
+		if (g_interrupt.cancelled()) {
+			break;
+		}
+		if (!exists(file)) {
+			if (batch) {
+				batch->flush(true);
 			}
+			cerr << "File \"" << file << "\" does not exist" << endl;
+			return 1;
+		}
 
-			auto eb = ExpressionBuilder(ws, syms);
+		Lambda::SourceFile source(file);
+		Lambda::SourceLines lines(source.begin(), source.end());
+		const char *begin;
+		const char *end;
+
+		while (!g_interrupt.cancelled() && lines.next(begin, end)) {
+			auto start = steady_clock::now();
+			ExpressionBuilder eb(begin, end, syms);
+			// Splitting the line into tokens counts towards its first
+			// expression
+			auto lexed = duration<double>(steady_clock::now() - start).count();
+			double parse_seconds;
+			// A parse error ends the run, after the output of the lines
+			// before it
+			auto parse1 = [&]() {
+				try {
+					auto start = steady_clock::now();
+					auto p = eb.parse1();
+					parse_seconds = lexed + duration<double>(steady_clock::now() - start).count();
+					lexed = 0;
+					return p;
+				} catch (...) {
+					if (batch) {
+						batch->flush(true);
+					}
+					throw;
+				}
+			};
 
 			ExpressionP expr;
-			auto p = eb.parse1();
+			auto p = parse1();
 			do {
 				expr = p.second;
-				if (p.first.empty()) {
+				if (p.first.empty() && batch) {
+					batch->eval(expr, string(begin, end), parse_seconds);
+				} else if (p.first.empty()) {
+					string line(begin, end);
 					cout << "---" << endl;
-					wcout << "Eval \"" << ws << "\"" << endl;
-					auto interm = expr;
-					int i=0;
-					do {
-						auto interm2 = interm;
-						//cout << "=> " << interm2 << endl;
-						interm = Nreduce1(interm);
-						if (!interm) {
-							cout << "... => " << interm2 << endl;
-						}
-						++i;
-					} while (interm);
+					cout << "Eval \"" << line << "\"" << endl;
+					auto outcome = evaluate(expr, options, line);
+					cout << "... " << outcome.result << endl;
+					if (options.stats) {
+						cerr << statsLine(line, options, parse_seconds, outcome) << endl;
+					}
+					exceeded = exceeded || outcome.status != "ok";
 				} else {
 					if (expr) {
-						cout << "DEF " << p.first << ":";
-						cout << syms->at(p.first).second;
-						cout << " = " << expr << std::endl;
+						ostringstream os;
+						os << "DEF " << p.first << ":";
+						os << syms->at(p.first).second;
+						os << " = " << expr << std::endl;
+						if (batch) {
+							batch->text(os.str());
+						} else {
+							cout << os.str();
+						}
 					}
 				}
-				p = eb.parse1();
+				p = parse1();
 			} while (p.second != nullptr);
-		} while (true);
+		}
+	}
+
+	if (batch) {
+		batch->flush(true);
+		exceeded = exceeded || batch->exceeded();
+		batch.reset();
+		concurrent.reset();
+	}
+
+	if (g_interrupt.cancelled()) {
+		cerr << "Interrupted" << endl;
+		return 1;
+	}
+
+	if (Lambda::Memo::enabled()) {
+		auto stats = Lambda::Memo::stats();
+		cerr << "memo: " << stats.hits << " hits, " << stats.misses << " misses, ";
+		cerr << stats.entries << " of " << stats.capacity << " entries" << endl;
+	}
+
+	if (!save_image.empty()) {
+		try {
+			Lambda::Image::save(save_image, *syms);
+		} catch (const runtime_error &e) {
+			cerr << e.what() << endl;
+			return 1;
+		}
 	}
 
-	return 0;
+	return exceeded ? 1 : 0;
 }
@@ -0,0 +1,117 @@
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "concurrent.h"
+#include "memo.h"
+
+using std::list;
+using std::mutex;
+using std::pair;
+using std::unordered_map;
+using std::vector;
+
+namespace Lambda {
+namespace Memo {
+
+namespace {
+
+// Most recently used first
+using Entries = list<pair<ExpressionP, ExpressionP>>;
+
+struct Table
+{
+	Table():
+		capacity(0),
+		hits(0),
+		misses(0) {}
+
+	size_t capacity;
+	Entries entries;
+	unordered_map<const Expression *, Entries::iterator> index;
+	unsigned long hits;
+	unsigned long misses;
+	mutex lock;
+};
+
+// Never destroyed, like the table of expressions the entries refer to
+Table &table()
+{
+	static auto table = new Table;
+	return *table;
+}
+
+bool eligible(const Expression &expr)
+{
+	return expr.loose() == 0 && dynamic_cast<const Application *>(&expr);
+}
+
+} // namespace
+
+void enable(size_t capacity)
+{
+	auto &t = table();
+	ConcurrentLock lock(t.lock);
+	t.capacity = capacity;
+}
+
+bool enabled()
+{
+	return table().capacity != 0;
+}
+
+ExpressionP lookup(const ExpressionP &expr)
+{
+	if (!enabled() || !eligible(*expr)) {
+		return nullptr;
+	}
+
+	auto &t = table();
+	ConcurrentLock lock(t.lock);
+	auto it = t.index.find(expr.get());
+	if (it == t.index.end()) {
+		++t.misses;
+		return nullptr;
+	}
+
+	++t.hits;
+	t.entries.splice(t.entries.begin(), t.entries, it->second);
+	return it->second->second;
+}
+
+void store(const ExpressionP &expr, const ExpressionP &normal)
+{
+	if (!enabled() || !eligible(*expr)) {
+		return;
+	}
+
+	// Dropped once the lock is released, as the last reference to a large
+	// term may go with them
+	vector<pair<ExpressionP, ExpressionP>> evicted;
+
+	auto &t = table();
+	ConcurrentLock lock(t.lock);
+	if (t.capacity == 0 || t.index.count(expr.get())) {
+		return;
+	}
+
+	t.entries.emplace_front(expr, normal);
+	t.index.emplace(expr.get(), t.entries.begin());
+	while (t.entries.size() > t.capacity) {
+		t.index.erase(t.entries.back().first.get());
+		evicted.push_back(std::move(t.entries.back()));
+		t.entries.pop_back();
+	}
+}
+
+Stats stats()
+{
+	auto &t = table();
+	ConcurrentLock lock(t.lock);
+	return Stats{t.hits, t.misses, t.entries.size(), t.capacity};
+}
+
+} // namespace Memo
+} // namespace Lambda
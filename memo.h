@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+
+#include "lambda.h"
+
+namespace Lambda {
+namespace Memo {
+
+// Normal forms of the closed applications normalized so far, shared by every
+// evaluation of the run and off unless enabled. Terms are keyed by node, since
+// hash-consing makes structurally equal terms the same node. Terms that only
+// differ in the names written on their binders are kept apart, as their
+// normal forms print differently. Once the table is full the least recently
+// used entry is dropped.
+
+// Keep up to capacity normal forms, none if zero
+void enable(size_t capacity);
+
+bool enabled();
+
+// The normal form of expr if it is in the table, null otherwise. Only closed
+// applications are ever in it, and only they count as hits or misses while
+// the table is enabled.
+ExpressionP lookup(const ExpressionP &expr);
+
+// Remember that normal is the normal form of expr, if expr is a closed
+// application
+void store(const ExpressionP &expr, const ExpressionP &normal);
+
+struct Stats
+{
+	unsigned long hits;
+	unsigned long misses;
+	size_t entries;
+	size_t capacity;
+};
+
+Stats stats();
+
+} // namespace Memo
+} // namespace Lambda
@@ -0,0 +1,328 @@
+#include <utility>
+#include <vector>
+
+#include "budget.h"
+#include "nbe.h"
+#include "region.h"
+
+using std::shared_ptr;
+using std::vector;
+
+namespace Lambda {
+namespace NbE {
+
+namespace {
+
+struct Value;
+using ValueP = shared_ptr<const Value>;
+
+struct Thunk;
+using ThunkP = shared_ptr<Thunk>;
+
+struct Env;
+using EnvP = shared_ptr<const Env>;
+
+struct Env
+{
+	Env(const ThunkP &value, const EnvP &next):
+		value(value),
+		next(next) {}
+
+	~Env()
+	{
+		releaseMember(value);
+		releaseMember(next);
+	}
+
+	const ThunkP value;
+	const EnvP next;
+};
+
+struct Value
+{
+	// An abstraction closed over env, or a Numeral, applied by going on with
+	// term in env
+	Value(const ExpressionP &term, const EnvP &env):
+		term(term),
+		env(env),
+		level(0) {}
+
+	// A Primitive short of the arguments in spine, a free Name, or else the
+	// variable at level, applied to spine
+	Value(const ExpressionP &head, unsigned level, RegionVector<ThunkP> spine):
+		head(head),
+		level(level),
+		spine(std::move(spine)) {}
+
+	~Value()
+	{
+		releaseMember(env);
+		for (auto &thunk: spine) {
+			releaseMember(thunk);
+		}
+	}
+
+	const ExpressionP term;
+	const EnvP env;
+
+	const ExpressionP head;
+	const unsigned level;
+	const RegionVector<ThunkP> spine;
+};
+
+ValueP eval(ExpressionP term, EnvP env, const RegionVector<ThunkP> &args = RegionVector<ThunkP>{});
+
+// A term in its environment, evaluated the first time its value is needed
+struct Thunk
+{
+	Thunk(const ExpressionP &term, const EnvP &env):
+		term(term),
+		env(env) {}
+
+	explicit Thunk(const ValueP &value):
+		value(value) {}
+
+	~Thunk()
+	{
+		releaseMember(env);
+		releaseMember(value);
+	}
+
+	const ValueP &force()
+	{
+		if (!value) {
+			value = eval(term, env);
+			term = nullptr;
+			env = nullptr;
+		}
+		return value;
+	}
+
+	// The numeral held, evaluated or not, null if there is none
+	const Numeral *numeral() const
+	{
+		return dynamic_cast<const Numeral *>(value ? value->term.get() : term.get());
+	}
+
+	ExpressionP term;
+	EnvP env;
+	ValueP value;
+};
+
+// An argument, or the thunk to update with the value reached
+struct Frame
+{
+	ThunkP thunk;
+	bool update;
+};
+
+EnvP extend(const ThunkP &value, const EnvP &next)
+{
+	return makeShared<Env>(value, next);
+}
+
+const ThunkP &lookup(const Env *env, unsigned index)
+{
+	for (; index > 0; --index) {
+		env = env->next.get();
+	}
+	return env->value;
+}
+
+ThunkP delay(const ExpressionP &arg, const EnvP &env)
+{
+	if (auto index = dynamic_cast<const Index *>(arg.get())) {
+		return lookup(env.get(), index->index());
+	}
+	return makeShared<Thunk>(arg, env);
+}
+
+// Goes on with the primitive applied to args, first argument first: with its
+// result, or with its definition applied to them if an argument is not a
+// numeral or the result overflows
+void delta(const Primitive &prim, const RegionVector<ThunkP> &args, RegionVector<Frame> &stack, ExpressionP &term, EnvP &env)
+{
+	env = nullptr;
+
+	// The last argument is evaluated first
+	vector<unsigned long> values(args.size());
+	for (auto i = args.size(); i-- > 0;) {
+		if (!prim.lazy()) {
+			args[i]->force();
+		}
+		auto num = args[i]->numeral();
+		if (!num) {
+			values.clear();
+			break;
+		}
+		values[i] = num->value();
+	}
+
+	if (!values.empty() && (term = prim.apply(values))) {
+		return;
+	}
+	for (auto it = args.rbegin(); it != args.rend(); ++it) {
+		stack.push_back(Frame{*it, false});
+	}
+	term = prim.definition();
+}
+
+// Hands value to what is on stack: updates the thunks it is the value of, and
+// gathers the arguments of a variable or a primitive into its spine. Returns
+// true if an abstraction, a numeral or a saturated primitive takes an argument
+// there, with the machine to go on with term in env.
+bool resume(ValueP &value, RegionVector<Frame> &stack, ExpressionP &term, EnvP &env)
+{
+	while (!stack.empty()) {
+		if (stack.back().update) {
+			auto &thunk = *stack.back().thunk;
+			thunk.value = value;
+			thunk.term = nullptr;
+			thunk.env = nullptr;
+			stack.pop_back();
+		} else if (auto num = dynamic_cast<const Numeral *>(value->term.get())) {
+			term = num->unfold();
+			env = nullptr;
+			return true;
+		} else if (value->term) {
+			term = value->term;
+			env = value->env;
+			return true;
+		} else {
+			auto prim = dynamic_cast<const Primitive *>(value->head.get());
+			auto spine = value->spine;
+			while (!stack.empty() && !stack.back().update && !(prim && spine.size() == prim->arity())) {
+				spine.push_back(stack.back().thunk);
+				stack.pop_back();
+			}
+			if (prim && spine.size() == prim->arity()) {
+				delta(*prim, spine, stack, term, env);
+				return true;
+			}
+			value = makeShared<Value>(value->head, value->level, std::move(spine));
+		}
+	}
+	return false;
+}
+
+// The value of term in env applied to args, the first one last. The arguments
+// and the thunks being evaluated are kept on a stack of its own, so neither a
+// beta step nor entering a thunk nests a call.
+ValueP eval(ExpressionP term, EnvP env, const RegionVector<ThunkP> &args)
+{
+	RegionVector<Frame> stack;
+	for (auto &arg: args) {
+		stack.push_back(Frame{arg, false});
+	}
+
+	while (true) {
+		Budget::step();
+		ValueP value;
+		if (auto app = dynamic_cast<const Application *>(term.get())) {
+			stack.push_back(Frame{delay(app->arg(), env), false});
+			term = app->func();
+			continue;
+		} else if (auto func = dynamic_cast<const Function *>(term.get())) {
+			if (!stack.empty() && !stack.back().update) {
+				Stats::beta();
+				env = extend(stack.back().thunk, env);
+				stack.pop_back();
+				term = func->body();
+				continue;
+			}
+			value = makeShared<Value>(term, env);
+		} else if (auto index = dynamic_cast<const Index *>(term.get())) {
+			auto thunk = lookup(env.get(), index->index());
+			if (!thunk->value) {
+				stack.push_back(Frame{thunk, true});
+				term = thunk->term;
+				env = thunk->env;
+				continue;
+			}
+			value = thunk->value;
+		} else if (dynamic_cast<const Numeral *>(term.get())) {
+			value = makeShared<Value>(term, nullptr);
+		} else {
+			// A Primitive with no arguments yet, or a free Name
+			value = makeShared<Value>(term, 0, RegionVector<ThunkP>{});
+		}
+
+		if (!resume(value, stack, term, env)) {
+			return value;
+		}
+	}
+}
+
+// Where reading back has got to: the binder to put around the body being
+// read, or a variable applied to the arguments of its spine up to next
+struct Read
+{
+	NameP vbound;
+	ValueP value;
+	ExpressionP result;
+	size_t next;
+	// Binders gone under to reach the abstraction or the variable
+	unsigned depth;
+};
+
+// depth is the number of binders gone under to reach value. Goes down the
+// value from a stack of its own rather than by recursion.
+ExpressionP readback(ValueP value, unsigned depth)
+{
+	RegionVector<Read> path;
+	ExpressionP result;
+
+	while (true) {
+		if (auto prim = dynamic_cast<const Primitive *>(value->head.get())) {
+			// Short of arguments, so read back what it stands for
+			value = eval(prim->definition(), nullptr, RegionVector<ThunkP>(value->spine.rbegin(), value->spine.rend()));
+			continue;
+		} else if (auto func = dynamic_cast<const Function *>(value->term.get())) {
+			auto var = makeShared<Thunk>(makeShared<Value>(nullptr, depth, RegionVector<ThunkP>{}));
+			path.push_back(Read{func->vbound(), nullptr, nullptr, 0, depth});
+			value = eval(func->body(), extend(var, value->env));
+			++depth;
+			continue;
+		} else if (value->term) {
+			// A numeral
+			result = value->term;
+		} else {
+			result = value->head ? value->head : Index::create(depth - 1 - value->level);
+			if (!value->spine.empty()) {
+				path.push_back(Read{nullptr, value, result, 1, depth});
+				value = value->spine[0]->force();
+				continue;
+			}
+		}
+
+		// Back up to a spine with arguments left to read
+		while (!path.empty()) {
+			auto &read = path.back();
+			depth = read.depth;
+			if (read.vbound) {
+				result = Function::fromIndexed(read.vbound, result);
+			} else {
+				read.result = Application::create(read.result, result);
+				if (read.next < read.value->spine.size()) {
+					value = read.value->spine[read.next++]->force();
+					break;
+				}
+				result = read.result;
+			}
+			path.pop_back();
+		}
+		if (path.empty()) {
+			return result;
+		}
+	}
+}
+
+} // namespace
+
+ExpressionP normalize(const ExpressionP expr)
+{
+	return readback(eval(expr, nullptr), 0);
+}
+
+} // namespace NbE
+} // namespace Lambda
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "lambda.h"
+
+namespace Lambda {
+namespace NbE {
+
+// Normal form of expr by normalization by evaluation. The expression is
+// evaluated into values where an abstraction is a closure of its body and
+// environment and a stuck application is a variable with its spine of
+// arguments, and the value is then read back into an expression, entering
+// closures with fresh variables to get at their bodies. Arguments are
+// evaluated on demand and at most once, so the result is the same as repeated
+// Nreduce1. Evaluation and read-back keep their own stacks in the region of
+// the evaluation, so neither depth of reduction nor depth of the result nests
+// calls.
+ExpressionP normalize(const ExpressionP expr);
+
+} // namespace NbE
+} // namespace Lambda
@@ -0,0 +1,931 @@
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "budget.h"
+#include "optimal.h"
+#include "region.h"
+
+using std::logic_error;
+using std::min;
+using std::pair;
+using std::shared_ptr;
+using std::static_pointer_cast;
+using std::swap;
+using std::vector;
+
+namespace Lambda {
+namespace Optimal {
+
+namespace {
+
+// The terms are translated with Lamping's levels: the argument of an
+// application at level n is built at level n+1, a variable occurrence at
+// level n goes through a croissant of level n on its way to its binder and
+// through a bracket of level n for every argument it leaves, and the
+// occurrences of a variable are shared by fans at the level they meet.
+enum class Kind: unsigned char {
+	// What the normal form is read from. Its port is not a principal one.
+	ROOT,
+	// Ports: the abstraction, its body and its variable
+	LAMBDA,
+	// Ports: the function, the argument and the result
+	APPLY,
+	// Ports: the shared side and the two sides sharing it
+	FAN,
+	// Levels above the croissant's are one lower on the second port
+	CROISSANT,
+	// Levels above the bracket's are one higher on the second port
+	BRACKET,
+	ERASER,
+	// A free Name, a Numeral or a Primitive
+	CONSTANT
+};
+
+// A node and one of its ports, port 0 being the principal one
+using Port = unsigned;
+
+const unsigned NONE = ~0u;
+
+Port port(unsigned node, unsigned slot)
+{
+	return node << 2 | slot;
+}
+
+unsigned nodeOf(Port p)
+{
+	return p >> 2;
+}
+
+unsigned slotOf(Port p)
+{
+	return p & 3;
+}
+
+// Number of ports besides the principal one
+unsigned arity(Kind kind)
+{
+	switch (kind) {
+	case Kind::LAMBDA:
+	case Kind::APPLY:
+	case Kind::FAN:
+		return 2;
+	case Kind::CROISSANT:
+	case Kind::BRACKET:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+bool sharing(Kind kind)
+{
+	return kind == Kind::FAN || kind == Kind::CROISSANT || kind == Kind::BRACKET;
+}
+
+struct Node
+{
+	Kind kind;
+	unsigned level;
+	Port peers[3];
+	// LAMBDA: the Name of the binder, CONSTANT: the expression
+	unsigned constant;
+	// The outermost read-back frame whose path goes through the node
+	unsigned mark;
+	// Where on the trail of the frame walking its path the node is first
+	// reached, if it still is there
+	unsigned step;
+};
+
+// What a path through the net has recorded at one level: either the sides it
+// took at the fans it went up through, the last one first, or the two levels
+// a bracket has merged into one
+struct Level;
+using LevelP = shared_ptr<const Level>;
+
+struct Level
+{
+	Level(bool side, const LevelP &rest):
+		merged(false),
+		side(side),
+		first(rest) {}
+
+	Level(const LevelP &first, const LevelP &second):
+		merged(true),
+		side(false),
+		first(first),
+		second(second) {}
+
+	~Level()
+	{
+		releaseMember(first);
+		releaseMember(second);
+	}
+
+	const bool merged;
+	const bool side;
+	const LevelP first;
+	const LevelP second;
+};
+
+// What a path has recorded at each level, as a list of the levels it has
+// recorded something at, the highest first. A change at a level builds new
+// entries for the levels from there up only, so the levels below are shared
+// with the context it was made from, and a context is copied in one go.
+struct Entry;
+using Context = shared_ptr<const Entry>;
+
+struct Entry
+{
+	Entry(unsigned level, const LevelP &value, const Context &next):
+		level(level),
+		value(value),
+		next(next) {}
+
+	~Entry()
+	{
+		releaseMember(value);
+		releaseMember(next);
+	}
+
+	const unsigned level;
+	const LevelP value;
+	const Context next;
+};
+
+LevelP at(const Context &ctx, unsigned i)
+{
+	for (auto entry = ctx.get(); entry && entry->level >= i; entry = entry->next.get()) {
+		if (entry->level == i) {
+			return entry->value;
+		}
+	}
+	return nullptr;
+}
+
+// The entries of ctx below level i
+const Context &below(const Context &ctx, unsigned i)
+{
+	auto rest = &ctx;
+	while (*rest && (*rest)->level >= i) {
+		rest = &(*rest)->next;
+	}
+	return *rest;
+}
+
+// The entries of ctx from level i up, moved up by shift levels, on top of base
+Context raise(const Context &ctx, unsigned i, int shift, Context base)
+{
+	vector<const Entry *> above;
+	for (auto entry = ctx.get(); entry && entry->level >= i; entry = entry->next.get()) {
+		above.push_back(entry);
+	}
+	for (auto it = above.rbegin(); it != above.rend(); ++it) {
+		base = makeShared<Entry>((*it)->level + shift, (*it)->value, base);
+	}
+	return base;
+}
+
+void put(Context &ctx, unsigned i, const LevelP &level)
+{
+	if (!level && !at(ctx, i)) {
+		return;
+	}
+	auto base = below(ctx, i);
+	if (level) {
+		base = makeShared<Entry>(i, level, base);
+	}
+	ctx = raise(ctx, i + 1, 0, base);
+}
+
+void insert(Context &ctx, unsigned i, const LevelP &level)
+{
+	auto base = below(ctx, i);
+	if (level) {
+		base = makeShared<Entry>(i, level, base);
+	}
+	ctx = raise(ctx, i, 1, base);
+}
+
+void remove(Context &ctx, unsigned i)
+{
+	ctx = raise(ctx, i + 1, -1, below(ctx, i));
+}
+
+bool same(const LevelP &a, const LevelP &b)
+{
+	vector<pair<const Level *, const Level *>> pending{{a.get(), b.get()}};
+	while (!pending.empty()) {
+		auto x = pending.back().first;
+		auto y = pending.back().second;
+		pending.pop_back();
+		if (x == y) {
+			continue;
+		}
+		if (!x || !y || x->merged != y->merged || x->side != y->side) {
+			return false;
+		}
+		pending.emplace_back(x->first.get(), y->first.get());
+		pending.emplace_back(x->second.get(), y->second.get());
+	}
+	return true;
+}
+
+// Whether the levels below levels are the same in a and b
+bool same(const Context &a, const Context &b, unsigned levels)
+{
+	auto x = below(a, levels).get();
+	auto y = below(b, levels).get();
+	// Up to where they share their entries
+	while (x != y) {
+		if (!x || !y || x->level != y->level || !same(x->value, y->value)) {
+			return false;
+		}
+		x = x->next.get();
+		y = y->next.get();
+	}
+	return true;
+}
+
+// The free variables of a subterm, in order of the position of their binder
+// counting from the outside, with the port each one comes in on
+using Free = vector<pair<unsigned, Port>>;
+
+// An abstraction read back, and the context it was reached in
+struct Binder
+{
+	unsigned node;
+	Context context;
+};
+
+// A point on the path a read-back frame walks: the port it is about to leave
+// by, what the path has recorded and how many applications it has passed by
+// then, and the node it reaches from there
+struct Step
+{
+	Port at;
+	Context context;
+	size_t spine;
+	unsigned node;
+};
+
+class Net
+{
+public:
+	explicit Net(const ExpressionP &expr);
+
+	ExpressionP readback();
+
+private:
+	// A value being read back. Until the head of the value is found, the
+	// path walked towards it from where the value comes in; then the
+	// abstraction whose body is being read back, or the head applied to the
+	// arguments read back so far.
+	struct Frame
+	{
+		// Where the value comes in, and what the path to it has recorded
+		Port from;
+		Context start;
+
+		Port at;
+		Context context;
+		// The applications the head is under, outermost first
+		vector<pair<unsigned, Context>> spine;
+		// Only kept until the head has been found, so only the frame on top
+		// has one. A frame without starts over from the beginning if it has
+		// to.
+		RegionVector<Step> trail;
+		// The nodes the frame has marked, unmarked when it is left
+		vector<unsigned> visited;
+		// The abstractions read back around the value
+		size_t bound;
+
+		bool found;
+		NameP vbound;
+		ExpressionP result;
+		// The arguments still to read back, the first one being the innermost
+		size_t left;
+	};
+
+	unsigned create(Kind kind, unsigned level, unsigned constant = 0);
+	void destroy(unsigned node);
+	unsigned constant(const ExpressionP &expr);
+
+	Port peer(Port p) const
+	{
+		return m_nodes[nodeOf(p)].peers[slotOf(p)];
+	}
+
+	bool principal(Port p) const
+	{
+		return slotOf(p) == 0 && m_nodes[nodeOf(p)].kind != Kind::ROOT;
+	}
+
+	void link(Port a, Port b);
+	bool active(unsigned a, unsigned b) const;
+
+	Port translate(const ExpressionP &expr, unsigned level, unsigned depth, Free &free);
+	void merge(const Free &a, const Free &b, unsigned level, Free &free);
+
+	void interact(unsigned a, unsigned b);
+	void expand(unsigned node);
+	void beta(unsigned lambda, unsigned apply);
+	void annihilate(unsigned a, unsigned b);
+	void commute(unsigned a, unsigned b, unsigned level);
+	void erase(unsigned eraser, unsigned node);
+	void collect();
+	void perform(unsigned a, unsigned b);
+
+	Port cross(unsigned node, unsigned slot, Context &ctx) const;
+	void enter(vector<Frame> &frames, Port from, Context ctx, size_t bound);
+	void leave(vector<Frame> &frames);
+	void visit(vector<Frame> &frames, unsigned node);
+	bool reached(const Frame &frame, unsigned node) const;
+	void back(Frame &frame, unsigned a, unsigned b);
+	void rewrite(vector<Frame> &frames, vector<Binder> &binders, unsigned a, unsigned b);
+	void walk(vector<Frame> &frames, vector<Binder> &binders);
+
+	// Kept in the region of the evaluation like the contexts, so that the net
+	// counts against its memory limits
+	RegionVector<Node> m_nodes;
+	RegionVector<unsigned> m_free;
+	RegionVector<ExpressionP> m_constants;
+	// Erasers that have met a principal port
+	RegionVector<pair<unsigned, unsigned>> m_garbage;
+	unsigned m_root;
+};
+
+Net::Net(const ExpressionP &expr)
+{
+	Free free;
+	auto root = translate(expr, 0, 0, free);
+	m_root = create(Kind::ROOT, 0);
+	link(port(m_root, 0), root);
+}
+
+unsigned Net::create(Kind kind, unsigned level, unsigned constant)
+{
+	Node node{kind, level, {NONE, NONE, NONE}, constant, NONE, NONE};
+	if (m_free.empty()) {
+		m_nodes.push_back(node);
+		return m_nodes.size() - 1;
+	}
+
+	auto index = m_free.back();
+	m_free.pop_back();
+	m_nodes[index] = node;
+	return index;
+}
+
+void Net::destroy(unsigned node)
+{
+	auto &n = m_nodes[node];
+	n.kind = Kind::ERASER;
+	n.peers[0] = n.peers[1] = n.peers[2] = NONE;
+	m_free.push_back(node);
+}
+
+unsigned Net::constant(const ExpressionP &expr)
+{
+	m_constants.push_back(expr);
+	return m_constants.size() - 1;
+}
+
+// Either port may belong to a node being rewritten, whose port then passes the
+// link on to whatever is connected to it later
+void Net::link(Port a, Port b)
+{
+	m_nodes[nodeOf(a)].peers[slotOf(a)] = b;
+	m_nodes[nodeOf(b)].peers[slotOf(b)] = a;
+
+	if (principal(a) && principal(b) &&
+			(m_nodes[nodeOf(a)].kind == Kind::ERASER || m_nodes[nodeOf(b)].kind == Kind::ERASER)) {
+		m_garbage.emplace_back(nodeOf(a), nodeOf(b));
+	}
+}
+
+// Whether two nodes connected by their principal ports can interact
+bool Net::active(unsigned a, unsigned b) const
+{
+	auto ka = m_nodes[a].kind;
+	auto kb = m_nodes[b].kind;
+	if (ka == Kind::APPLY) {
+		swap(a, b);
+		swap(ka, kb);
+	}
+	if (ka == Kind::CONSTANT && kb == Kind::APPLY) {
+		// A free name applied to something stays as it is
+		return !dynamic_cast<const Name *>(m_constants[m_nodes[a].constant].get());
+	}
+	return true;
+}
+
+// Builds the net for expr at level with depth binders around it, returning the
+// port its value comes out of and adding its free variables to free. Works
+// from a stack of its own rather than by recursion.
+Port Net::translate(const ExpressionP &expr, unsigned level, unsigned depth, Free &free)
+{
+	// A subterm to build, or to finish once its parts have been built
+	struct Task
+	{
+		ExpressionP expr;
+		unsigned level;
+		unsigned depth;
+		bool parts;
+	};
+	vector<Task> tasks{Task{expr, level, depth, false}};
+	// The port and free variables of each subterm built, the last one on top
+	vector<pair<Port, Free>> built;
+
+	while (!tasks.empty()) {
+		auto task = tasks.back();
+		tasks.pop_back();
+		if (auto app = dynamic_cast<const Application *>(task.expr.get())) {
+			if (!task.parts) {
+				tasks.push_back(Task{task.expr, task.level, task.depth, true});
+				tasks.push_back(Task{app->arg(), task.level + 1, task.depth, false});
+				tasks.push_back(Task{app->func(), task.level, task.depth, false});
+				continue;
+			}
+			auto arg = std::move(built.back());
+			built.pop_back();
+			auto func = std::move(built.back());
+			built.pop_back();
+			for (auto &var: arg.second) {
+				auto bracket = create(Kind::BRACKET, task.level);
+				link(port(bracket, 1), var.second);
+				var.second = port(bracket, 0);
+			}
+			Free merged;
+			merge(func.second, arg.second, task.level, merged);
+
+			auto node = create(Kind::APPLY, task.level);
+			link(port(node, 0), func.first);
+			link(port(node, 1), arg.first);
+			built.emplace_back(port(node, 2), std::move(merged));
+		} else if (auto func = dynamic_cast<const Function *>(task.expr.get())) {
+			if (!task.parts) {
+				tasks.push_back(Task{task.expr, task.level, task.depth, true});
+				tasks.push_back(Task{func->body(), task.level, task.depth + 1, false});
+				continue;
+			}
+			auto &body = built.back();
+			auto node = create(Kind::LAMBDA, task.level, constant(func->vbound()));
+			link(port(node, 1), body.first);
+			if (!body.second.empty() && body.second.back().first == task.depth) {
+				link(port(node, 2), body.second.back().second);
+				body.second.pop_back();
+			} else {
+				auto eraser = create(Kind::ERASER, task.level);
+				link(port(node, 2), port(eraser, 0));
+			}
+			body.first = port(node, 0);
+		} else if (auto index = dynamic_cast<const Index *>(task.expr.get())) {
+			auto node = create(Kind::CROISSANT, task.level);
+			built.emplace_back(port(node, 1), Free{{task.depth - 1 - index->index(), port(node, 0)}});
+		} else {
+			auto node = create(Kind::CONSTANT, task.level, constant(task.expr));
+			built.emplace_back(port(node, 0), Free{});
+		}
+	}
+
+	free.insert(free.end(), built.back().second.begin(), built.back().second.end());
+	return built.back().first;
+}
+
+// Puts the free variables of a and b together in free, sharing the ones that
+// occur in both with a fan
+void Net::merge(const Free &a, const Free &b, unsigned level, Free &free)
+{
+	auto ia = a.begin();
+	auto ib = b.begin();
+	while (ia != a.end() || ib != b.end()) {
+		if (ib == b.end() || (ia != a.end() && ia->first < ib->first)) {
+			free.push_back(*ia++);
+		} else if (ia == a.end() || ib->first < ia->first) {
+			free.push_back(*ib++);
+		} else {
+			auto fan = create(Kind::FAN, level);
+			link(port(fan, 1), ia->second);
+			link(port(fan, 2), ib->second);
+			free.emplace_back(ia->first, port(fan, 0));
+			++ia;
+			++ib;
+		}
+	}
+}
+
+void Net::interact(unsigned a, unsigned b)
+{
+	if (m_nodes[a].kind == Kind::ERASER) {
+		erase(a, b);
+		return;
+	} else if (m_nodes[b].kind == Kind::ERASER) {
+		erase(b, a);
+		return;
+	}
+
+	if (m_nodes[a].kind == Kind::APPLY) {
+		swap(a, b);
+	}
+	auto ka = m_nodes[a].kind;
+	auto kb = m_nodes[b].kind;
+	if (ka == Kind::LAMBDA && kb == Kind::APPLY) {
+		beta(a, b);
+		return;
+	} else if (ka == Kind::CONSTANT && kb == Kind::APPLY) {
+		expand(a);
+		return;
+	}
+
+	auto la = m_nodes[a].level;
+	auto lb = m_nodes[b].level;
+	if (ka == kb && sharing(ka) && la == lb) {
+		annihilate(a, b);
+		return;
+	}
+
+	// Otherwise the node with the lower level acts on the other: a fan copies
+	// it, and a croissant or a bracket moves it down or up a level if it is
+	// above its own
+	if (!sharing(ka) || (sharing(kb) && lb < la)) {
+		swap(a, b);
+		swap(ka, kb);
+		swap(la, lb);
+	}
+	if (!sharing(ka) || (ka != Kind::FAN && la == lb) || (sharing(kb) && la == lb)) {
+		throw logic_error("Optimal: nodes that cannot interact met");
+	}
+
+	if (ka == Kind::CROISSANT && lb > la) {
+		--lb;
+	} else if (ka == Kind::BRACKET && lb > la) {
+		++lb;
+	}
+	commute(a, b, lb);
+}
+
+// Replaces a numeral or a primitive by the lambda term it stands for
+void Net::expand(unsigned node)
+{
+	auto expr = m_constants[m_nodes[node].constant];
+	ExpressionP term;
+	if (auto num = dynamic_cast<const Numeral *>(expr.get())) {
+		term = num->unfold();
+	} else {
+		term = static_cast<const Primitive &>(*expr).definition();
+	}
+
+	// Closed, so it can be built at any level
+	Free free;
+	auto root = translate(term, m_nodes[node].level, 0, free);
+	link(root, peer(port(node, 0)));
+	destroy(node);
+}
+
+void Net::beta(unsigned lambda, unsigned apply)
+{
+	Stats::beta();
+	link(peer(port(lambda, 1)), peer(port(apply, 2)));
+	link(peer(port(lambda, 2)), peer(port(apply, 1)));
+	destroy(lambda);
+	destroy(apply);
+}
+
+void Net::annihilate(unsigned a, unsigned b)
+{
+	for (unsigned slot = 1; slot <= arity(m_nodes[a].kind); ++slot) {
+		link(peer(port(a, slot)), peer(port(b, slot)));
+	}
+	destroy(a);
+	destroy(b);
+}
+
+// Moves a past b, putting a copy of b with the given level on each of the
+// other ports of a and a copy of a on each of the other ports of b
+void Net::commute(unsigned a, unsigned b, unsigned level)
+{
+	auto ka = m_nodes[a].kind;
+	auto kb = m_nodes[b].kind;
+	auto la = m_nodes[a].level;
+	auto constant = m_nodes[b].constant;
+
+	unsigned bs[2];
+	unsigned as[2];
+	for (unsigned i = 0; i < arity(ka); ++i) {
+		bs[i] = create(kb, level, constant);
+	}
+	for (unsigned j = 0; j < arity(kb); ++j) {
+		as[j] = create(ka, la);
+	}
+
+	for (unsigned j = 0; j < arity(kb); ++j) {
+		for (unsigned i = 0; i < arity(ka); ++i) {
+			link(port(as[j], i + 1), port(bs[i], j + 1));
+		}
+	}
+	for (unsigned i = 0; i < arity(ka); ++i) {
+		link(port(bs[i], 0), peer(port(a, i + 1)));
+	}
+	for (unsigned j = 0; j < arity(kb); ++j) {
+		link(port(as[j], 0), peer(port(b, j + 1)));
+	}
+
+	destroy(a);
+	destroy(b);
+}
+
+void Net::erase(unsigned eraser, unsigned node)
+{
+	for (unsigned slot = 1; slot <= arity(m_nodes[node].kind); ++slot) {
+		auto copy = create(Kind::ERASER, 0);
+		link(port(copy, 0), peer(port(node, slot)));
+	}
+	destroy(eraser);
+	destroy(node);
+}
+
+// Erases what the erasers have reached, except the nodes on a path being read
+// back
+void Net::collect()
+{
+	while (!m_garbage.empty()) {
+		auto a = m_garbage.back().first;
+		auto b = m_garbage.back().second;
+		m_garbage.pop_back();
+
+		if (peer(port(a, 0)) != port(b, 0)) {
+			continue;
+		}
+		if (m_nodes[a].kind != Kind::ERASER) {
+			swap(a, b);
+		}
+		if (m_nodes[a].kind == Kind::ERASER && m_nodes[b].mark == NONE) {
+			erase(a, b);
+		}
+	}
+}
+
+void Net::perform(unsigned a, unsigned b)
+{
+	Budget::step();
+	if (b == NONE) {
+		expand(a);
+	} else {
+		interact(a, b);
+	}
+	collect();
+}
+
+// Moves through a fan, croissant or bracket entered on slot, keeping track of
+// what the path has done in ctx, and returns the port it leaves by
+Port Net::cross(unsigned node, unsigned slot, Context &ctx) const
+{
+	auto &n = m_nodes[node];
+	auto i = n.level;
+
+	switch (n.kind) {
+	case Kind::FAN:
+		if (slot != 0) {
+			put(ctx, i, makeShared<Level>(slot == 2, at(ctx, i)));
+			return port(node, 0);
+		} else {
+			auto level = at(ctx, i);
+			if (!level || level->merged) {
+				throw logic_error("Optimal: fan entered without a side to leave by");
+			}
+			put(ctx, i, level->first);
+			return port(node, level->side ? 2 : 1);
+		}
+	case Kind::CROISSANT:
+		if (slot != 0) {
+			insert(ctx, i, nullptr);
+			return port(node, 0);
+		} else {
+			remove(ctx, i);
+			return port(node, 1);
+		}
+	case Kind::BRACKET:
+		if (slot != 0) {
+			auto first = at(ctx, i);
+			auto second = at(ctx, i + 1);
+			remove(ctx, i + 1);
+			put(ctx, i, first || second ? makeShared<Level>(first, second) : nullptr);
+			return port(node, 0);
+		} else {
+			auto level = at(ctx, i);
+			if (level && !level->merged) {
+				throw logic_error("Optimal: bracket entered without levels to split");
+			}
+			put(ctx, i, level ? level->first : nullptr);
+			insert(ctx, i + 1, level ? level->second : nullptr);
+			return port(node, 1);
+		}
+	default:
+		throw logic_error("Optimal: crossed a node that does not share");
+	}
+}
+
+void Net::enter(vector<Frame> &frames, Port from, Context ctx, size_t bound)
+{
+	frames.push_back(Frame{from, ctx, from, ctx, {}, {}, {}, bound, false, nullptr, nullptr, 0});
+}
+
+void Net::leave(vector<Frame> &frames)
+{
+	unsigned depth = frames.size() - 1;
+	for (auto node: frames.back().visited) {
+		auto &mark = m_nodes[node].mark;
+		if (mark == depth) {
+			mark = NONE;
+		}
+	}
+	frames.pop_back();
+}
+
+void Net::visit(vector<Frame> &frames, unsigned node)
+{
+	unsigned depth = frames.size() - 1;
+	auto &mark = m_nodes[node].mark;
+	if (mark > depth) {
+		mark = depth;
+		frames.back().visited.push_back(node);
+	}
+}
+
+// Whether the path of frame reaches node, at the step of the node
+bool Net::reached(const Frame &frame, unsigned node) const
+{
+	auto step = m_nodes[node].step;
+	return step < frame.trail.size() && frame.trail[step].node == node;
+}
+
+// Takes the path of frame back to just before it first reaches a or b, which
+// are about to be rewritten. The path up to there stays the same.
+void Net::back(Frame &frame, unsigned a, unsigned b)
+{
+	auto &trail = frame.trail;
+	if (trail.empty()) {
+		frame.at = frame.from;
+		frame.context = frame.start;
+		frame.spine.clear();
+		return;
+	}
+
+	size_t k = trail.size();
+	for (auto node: {a, b}) {
+		if (node != NONE && reached(frame, node)) {
+			k = min<size_t>(k, m_nodes[node].step);
+		}
+	}
+	if (k == trail.size()) {
+		k = 0;
+	}
+	frame.at = trail[k].at;
+	frame.context = trail[k].context;
+	frame.spine.resize(trail[k].spine);
+	trail.resize(k);
+}
+
+// Rewrites a and b, or expands a if b is NONE, from the outermost frame whose
+// path goes through either: the frames above it are left, and it starts over
+// from just before its path reaches them
+void Net::rewrite(vector<Frame> &frames, vector<Binder> &binders, unsigned a, unsigned b)
+{
+	auto outer = m_nodes[a].mark;
+	if (b != NONE) {
+		outer = min(outer, m_nodes[b].mark);
+	}
+	while (outer < frames.size() - 1) {
+		leave(frames);
+	}
+
+	auto &frame = frames.back();
+	binders.resize(frame.bound);
+	frame.found = false;
+	frame.vbound = nullptr;
+	frame.result = nullptr;
+	back(frame, a, b);
+	perform(a, b);
+}
+
+// Takes the path of the frame on top one node further towards the head of its
+// value, performing the interaction met there if there is one. Once the head
+// is found, enters the body of an abstraction, or leaves the head in the
+// frame for its arguments to be read back.
+void Net::walk(vector<Frame> &frames, vector<Binder> &binders)
+{
+	auto &frame = frames.back();
+	auto end = peer(frame.at);
+	auto node = nodeOf(end);
+	if (!reached(frame, node)) {
+		m_nodes[node].step = frame.trail.size();
+	}
+	frame.trail.push_back(Step{frame.at, frame.context, frame.spine.size(), node});
+	visit(frames, node);
+
+	if (principal(frame.at) && principal(end) && active(nodeOf(frame.at), node)) {
+		rewrite(frames, binders, nodeOf(frame.at), node);
+		return;
+	}
+
+	auto kind = m_nodes[node].kind;
+	if (sharing(kind)) {
+		frame.at = cross(node, slotOf(end), frame.context);
+		return;
+	} else if (kind == Kind::APPLY && slotOf(end) == 2) {
+		frame.spine.emplace_back(node, frame.context);
+		frame.at = port(node, 0);
+		return;
+	}
+
+	auto expr = m_constants[m_nodes[node].constant];
+	if (kind == Kind::CONSTANT && dynamic_cast<const Primitive *>(expr.get())) {
+		// Short of arguments
+		rewrite(frames, binders, node, NONE);
+		return;
+	}
+
+	// The rest is read back in the frames above, and a long path need not be
+	// kept while they are, nor what it recorded
+	frame.found = true;
+	RegionVector<Step>{}.swap(frame.trail);
+	if (kind == Kind::LAMBDA && slotOf(end) == 0 && frame.spine.empty()) {
+		frame.vbound = static_pointer_cast<Name>(expr);
+		binders.push_back(Binder{node, frame.context});
+		enter(frames, port(node, 1), std::move(frame.context), binders.size());
+		return;
+	} else if (kind == Kind::LAMBDA && slotOf(end) == 2) {
+		auto level = m_nodes[node].level;
+		for (auto i = binders.size(); i-- > 0;) {
+			if (binders[i].node == node && same(binders[i].context, frame.context, level)) {
+				frame.result = Index::create(binders.size() - 1 - i);
+				break;
+			}
+		}
+		if (!frame.result) {
+			throw logic_error("Optimal: variable read back outside its abstraction");
+		}
+	} else if (kind == Kind::CONSTANT && (frame.spine.empty() || dynamic_cast<const Name *>(expr.get()))) {
+		frame.result = expr;
+	} else {
+		throw logic_error("Optimal: no value at the end of the path");
+	}
+	frame.left = frame.spine.size();
+	frame.context = nullptr;
+}
+
+// The normal form of the net. Each value is read back in a frame of its own
+// on a stack: the path to its head is walked, performing the interactions met
+// on the way, and the body of the abstraction or the arguments found are read
+// back in the frames above it. An interaction on the path of a frame further
+// down goes back to that frame and has it start over.
+ExpressionP Net::readback()
+{
+	vector<Frame> frames;
+	vector<Binder> binders;
+	enter(frames, port(m_root, 0), nullptr, 0);
+
+	// What the frame left last has read back
+	ExpressionP value;
+	while (true) {
+		auto &frame = frames.back();
+		if (!frame.found) {
+			walk(frames, binders);
+			continue;
+		}
+
+		if (value) {
+			if (frame.vbound) {
+				binders.pop_back();
+				frame.result = Function::fromIndexed(frame.vbound, value);
+			} else {
+				frame.result = Application::create(frame.result, value);
+			}
+			value = nullptr;
+		}
+		if (!frame.vbound && frame.left > 0) {
+			auto &app = frame.spine[--frame.left];
+			enter(frames, port(app.first, 1), app.second, binders.size());
+			continue;
+		}
+
+		value = frame.result;
+		leave(frames);
+		if (frames.empty()) {
+			return value;
+		}
+	}
+}
+
+} // namespace
+
+ExpressionP normalize(const ExpressionP expr)
+{
+	Net net{expr};
+	return net.readback();
+}
+
+} // namespace Optimal
+} // namespace Lambda
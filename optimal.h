@@ -0,0 +1,18 @@
+#pragma once
+
+#include "lambda.h"
+
+namespace Lambda {
+namespace Optimal {
+
+// Normal form of expr by Lamping's optimal reduction. The expression is
+// translated into a sharing graph, an interaction net whose fans duplicate
+// one node at a time and whose brackets and croissants keep track of which
+// fans pair up, so no redex is ever copied before it has been contracted.
+// Only the interactions on the path the normal form is read back along are
+// performed, leftmost-outermost first, and the result is the same as repeated
+// Nreduce1.
+ExpressionP normalize(const ExpressionP expr);
+
+} // namespace Optimal
+} // namespace Lambda
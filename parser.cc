@@ -1,34 +1,32 @@
 #include <algorithm>
-#include <cwchar>
-#include <ios>
-#include <memory>
+#include <climits>
+#include <cstring>
 #include <deque>
+#include <iterator>
+#include <memory>
 
 #include "parser.h"
+#include "source.h"
 
 using std::all_of;
 using std::codecvt_utf8;
-using std::dynamic_pointer_cast;
-using std::isalnum;
-using std::locale;
 using std::make_pair;
 using std::make_shared;
-using std::noskipws;
 using std::out_of_range;
 using std::pair;
 using std::runtime_error;
-using std::skipws;
+using std::string;
 using std::deque;
+using std::vector;
 using std::wstring;
 using std::wstring_convert;
-using std::wstringstream;
 
 namespace Lambda {
 namespace Parser {
 
-const symbol_table &builtins()
+const SymbolTable &builtins()
 {
-	const static symbol_table bins = {
+	const static SymbolTable bins = {
 		{"builtin_zero", {Expressions::zero, 0}},
 		{"builtin_one", {Expressions::one, 0}},
 		{"builtin_select_first", {Expressions::select_first, 2}},
@@ -42,6 +40,7 @@ const symbol_table &builtins()
 		{"builtin_pred", {Expressions::pred, 1}},
 		{"builtin_add", {Expressions::add, 2}},
 		{"builtin_sub", {Expressions::sub, 2}},
+		{"builtin_mult", {Expressions::mult, 2}},
 		{"builtin_abs_diff", {Expressions::abs_diff, 2}},
 		{"builtin_equal", {Expressions::equal, 2}},
 		{"builtin_make_obj", {Expressions::make_obj, 2}},
@@ -60,141 +59,202 @@ const symbol_table &builtins()
 
 SymbolTableP newDefaultSymTable()
 {
-	return make_shared<symbol_table>(builtins());
+	return make_shared<SymbolTable>(builtins());
 }
 
-template<> pair<bool, ExpressionP> ExpressionBuilder::parse(ParseContext &ctx);
-template<> pair<bool, NameP> ExpressionBuilder::parse(ParseContext &ctx);
-template<> pair<bool, FunctionP> ExpressionBuilder::parse(ParseContext &ctx);
-template<> pair<bool, ApplicationP> ExpressionBuilder::parse(ParseContext &ctx);
-
-std::wostream &operator<<(std::wostream &os, const Token &tok)
+std::ostream &operator<<(std::ostream &os, const Token &tok)
 {
-	os << tok.val;
+	os.write(tok.text, tok.size);
 	return os;
 }
 
-std::wistream &operator>>(std::wistream &is, Token &token)
+namespace {
+
+bool isWord(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+bool is(const char *text, size_t size, const char *keyword)
+{
+	return size == std::strlen(keyword) && std::memcmp(text, keyword, size) == 0;
+}
+
+Token word(const char *text, size_t size)
 {
-	if (!is.good()) {
-		return is;
+	if (is(text, size, "def")) {
+		return Token(Token::Type::DEF, text, size);
+	} else if (is(text, size, "rec")) {
+		return Token(Token::Type::REC, text, size);
+	} else if (is(text, size, "if")) {
+		return Token(Token::Type::IF, text, size);
+	} else if (is(text, size, "then")) {
+		return Token(Token::Type::THEN, text, size);
+	} else if (is(text, size, "else")) {
+		return Token(Token::Type::ELSE, text, size);
+	} else if (is(text, size, "IF")) {
+		return Token(Token::Type::IF_TYPED, text, size);
+	} else if (is(text, size, "THEN")) {
+		return Token(Token::Type::THEN_TYPED, text, size);
+	} else if (is(text, size, "ELSE")) {
+		return Token(Token::Type::ELSE_TYPED, text, size);
+	} else if (all_of(text, text + size, [](char c){ return c >= '0' && c <= '9'; })) {
+		return Token(Token::Type::INTLITERAL, text, size);
 	}
+	return Token(Token::Type::OBJECT, text, size);
+}
+
+// The value of a literal, which has to fit in a numeral
+unsigned long literal(const Token &tok)
+{
+	unsigned long value = 0;
+	for (size_t i = 0; i < tok.size; ++i) {
+		unsigned long digit = tok.text[i] - '0';
+		if (value > (ULONG_MAX - digit) / 10) {
+			throw runtime_error("Literal \"" + string(tok.text, tok.size) + "\" is too large");
+		}
+		value = value * 10 + digit;
+	}
+	return value;
+}
+
+// The bytes of the UTF-8 character at p
+size_t sequence(const char *p, const char *end)
+{
+	auto lead = static_cast<unsigned char>(*p);
+	size_t size = lead < 0xc0 ? 1 : lead < 0xe0 ? 2 : lead < 0xf0 ? 3 : 4;
+	size_t i = 1;
+	while (i < size && p + i != end && (static_cast<unsigned char>(p[i]) & 0xc0) == 0x80) {
+		++i;
+	}
+	return i;
+}
 
-	wchar_t c;
-	is >> c;
+} // namespace
 
-	// Single character tokens
-	if (!is.fail()) {
-		if (c == L'λ') {
-			token = Token(Token::Type::LAMBDA, wstring(1, c));
+vector<Token> tokenize(const char *begin, const char *end)
+{
+	vector<Token> tokens;
+	auto p = begin;
+	while (true) {
+		p = skipSpace(p, end);
+		if (p == end) {
+			return tokens;
+		}
+
+		// Single character tokens, λ being two bytes
+		auto c = *p;
+		if (c == '\xce' && p + 1 != end && p[1] == '\xbb') {
+			tokens.emplace_back(Token::Type::LAMBDA, p, 2);
+			p += 2;
 		} else if (c == '.') {
-			token = Token(Token::Type::DOT, wstring(1, c));
+			tokens.emplace_back(Token::Type::DOT, p++, 1);
 		} else if (c == '(') {
-			token = Token(Token::Type::L_PAREN, wstring(1, c));
+			tokens.emplace_back(Token::Type::L_PAREN, p++, 1);
 		} else if (c == ')') {
-			token = Token(Token::Type::R_PAREN, wstring(1, c));
+			tokens.emplace_back(Token::Type::R_PAREN, p++, 1);
 		} else if (c == '=') {
-			token = Token(Token::Type::EQUALS, wstring(1, c));
-		} else {
-			std::wstring word;
-			
-			is >> noskipws;
-			while (!is.fail()) {
-				if (!isalnum(c) && c != '_') {
-					is.clear();
-					is.putback(c);
-					break;
-				}
-
-				word += c;
-
-				if (!is.good()) {
-					break;
-				}
-
-				is >> c;
-			}
-			is.clear();
-			is >> skipws;
-
-			if (word == L"def") {
-				token = Token(Token::Type::DEF, word);
-			} else if (word == L"rec") {
-				token = Token(Token::Type::REC, word);
-			} else if (word == L"if") {
-				token = Token(Token::Type::IF, word);
-			} else if (word == L"then") {
-				token = Token(Token::Type::THEN, word);
-			} else if (word == L"else") {
-				token = Token(Token::Type::ELSE, word);
-			} else if (word == L"IF") {
-				token = Token(Token::Type::IF_TYPED, word);
-			} else if (word == L"THEN") {
-				token = Token(Token::Type::THEN_TYPED, word);
-			} else if (word == L"ELSE") {
-				token = Token(Token::Type::ELSE_TYPED, word);
-			} else if (all_of(word.begin(), word.end(), [](wchar_t c){ return isdigit(c); })) {
-				token = Token(Token::Type::INTLITERAL, word);
-			} else {
-				token = Token(Token::Type::OBJECT, word);
+			tokens.emplace_back(Token::Type::EQUALS, p++, 1);
+		} else if (isWord(c)) {
+			auto start = p;
+			while (p != end && isWord(*p)) {
+				++p;
 			}
+			tokens.push_back(word(start, p - start));
+		} else {
+			auto size = sequence(p, end);
+			tokens.emplace_back(Token::Type::INVALID, p, size);
+			p += size;
 		}
 	}
+}
 
-#if 0
-	if (token.type == Token::Type::INVALID) {
-		std::wcout << "Read token [INVALID]" << std::endl;
-	} else {
-		std::wcout << "Read token [" << token.val << "]" << std::endl;
-	}
-#endif
+ExpressionBuilder::ExpressionBuilder(const char *begin, const char *end, SymbolTableP syms):
+	m_tokens(tokenize(begin, end)),
+	m_pos(0),
+	m_exhausted(false),
+	m_syms(syms ? syms : make_shared<SymbolTable>()),
+	m_parsed(2 * (m_tokens.size() + 1), Parsed{0, false, nullptr, 0}),
+	m_generation(0)
+{
+}
 
-	return is;
+ExpressionBuilder::ExpressionBuilder(std::wistream &is, SymbolTableP syms):
+	ExpressionBuilder(wstring(std::istreambuf_iterator<wchar_t>(is), std::istreambuf_iterator<wchar_t>()), syms)
+{
 }
 
-pair<symbol_table::key_type, ExpressionP> ExpressionBuilder::parse1()
+ExpressionBuilder::ExpressionBuilder(const wstring &expression, SymbolTableP syms):
+	ExpressionBuilder(wstring_convert<codecvt_utf8<wchar_t>>().to_bytes(expression), syms)
 {
-	auto startpos = m_tokens.tellg();
-	auto flags = m_tokens.rdstate();
+}
 
-	if (m_tokens.eof() || startpos == -1) {
-		return make_pair("_", nullptr);
+ExpressionBuilder::ExpressionBuilder(const string &expression, SymbolTableP syms):
+	m_text(expression),
+	m_tokens(tokenize(m_text.data(), m_text.data() + m_text.size())),
+	m_pos(0),
+	m_exhausted(false),
+	m_syms(syms ? syms : make_shared<SymbolTable>()),
+	m_parsed(2 * (m_tokens.size() + 1), Parsed{0, false, nullptr, 0}),
+	m_generation(0)
+{
+}
+
+bool ExpressionBuilder::next(Token &tok)
+{
+	if (m_exhausted || m_pos == m_tokens.size()) {
+		m_exhausted = true;
+		return false;
 	}
+	tok = m_tokens[m_pos++];
+	return true;
+}
 
-	if (!m_tokens.good() || startpos == -1) {
-		throw runtime_error("Could not parse");
+void ExpressionBuilder::seek(size_t pos)
+{
+	if (!m_exhausted) {
+		m_pos = pos;
 	}
+}
+
+ExpressionBuilder::Parsed &ExpressionBuilder::parsed(size_t pos, ParentPos ppos)
+{
+	return m_parsed[2 * pos + (ppos == ParentPos::APPLICATION_EXPR)];
+}
 
+pair<string, ExpressionP> ExpressionBuilder::parse1()
+{
+	// What was parsed before may have been defined since
+	++m_generation;
+
+	auto start = m_pos;
 	Token tok;
-	m_tokens >> tok;
-	if (m_tokens.eof()) {
+	if (!next(tok)) {
 		return make_pair("_", nullptr);
 	}
+
 	bool rec = (tok.type == Token::Type::REC);
-	if (m_tokens.good() && (tok.type == Token::Type::DEF || rec)) {
-		m_tokens >> tok;
-		if (m_tokens.good() && tok.type == Token::Type::OBJECT) {
-			auto name = s_convert.to_bytes(tok.val);
-			if (m_syms->find(name) != m_syms->end()) {
+	if (tok.type == Token::Type::DEF || rec) {
+		if (next(tok) && tok.type == Token::Type::OBJECT) {
+			auto name = tok.str();
+			if (m_syms->find(name)) {
 				throw runtime_error("Redefinition of symbol \"" + name + "\"");
 			}
-			m_tokens >> tok;
 			deque<NameP> varq;
-			while (m_tokens.good() && tok.type == Token::Type::OBJECT) {
-				varq.push_back(Name::create(s_convert.to_bytes(tok.val)));
-				m_tokens >> tok;
+			auto more = next(tok);
+			while (more && tok.type == Token::Type::OBJECT) {
+				varq.push_back(Name::create(tok.str()));
+				more = next(tok);
 			}
-			if (m_tokens.good() && tok.type == Token::Type::EQUALS) {
-				auto s2 = std::make_shared<symbol_table>(*m_syms);
-				ParseContext ctx{s2};
+			if (more && tok.type == Token::Type::EQUALS) {
+				// The body sees name as self^, in a table that shares
+				// all but a path with the one it extends
 				const auto self = Name::create("self^");
+				auto s2 = make_shared<SymbolTable>(m_syms->with(name, make_pair(self, varq.size())));
 
-				(*s2)[name] = make_pair(self, varq.size());
-
-				auto p = parse<Expression>(ctx);
+				auto p = parseExpression(s2);
 				if (p.first) {
 					auto q = p.second;
-					auto varq2 = varq;
 					size_t nargs = varq.size();
 					while (!varq.empty()) {
 						q = Function::create(varq.back(), q);
@@ -209,7 +269,7 @@ pair<symbol_table::key_type, ExpressionP> ExpressionBuilder::parse1()
 							)
 						);
 					}
-					(*m_syms)[name] = make_pair(q, nargs);
+					m_syms->set(name, make_pair(q, nargs));
 					return make_pair(name, q);
 				}
 			}
@@ -217,337 +277,207 @@ pair<symbol_table::key_type, ExpressionP> ExpressionBuilder::parse1()
 		throw runtime_error("Could not parse");
 	}
 
-	m_tokens.setstate(flags);
-	m_tokens.seekg(startpos);
-
-	if (m_tokens.eof()) {
-		return make_pair("_", nullptr);
-	}
-
-	ParseContext ctx{m_syms};
-	auto p = parse<Expression>(ctx);
+	seek(start);
+	auto p = parseExpression(m_syms);
 	if (p.first) {
 		return make_pair("", p.second);
 	}
 
-	if (m_tokens.eof()) {
-		return make_pair("_", nullptr);
-	}
-
 	throw runtime_error("Could not parse");
 }
 
-template<> pair<bool, ExpressionP> ExpressionBuilder::parse(ParseContext &ctx)
-{
-	{
-		auto p = parseIfThenElse(ctx);
-		if (p.first) {
-			return make_pair(true, p.second);
-		}
-	}
-
-	{
-		auto p = parseTypedIfThenElse(ctx);
-		if (p.first) {
-			return make_pair(true, p.second);
-		}
-	}
-	
-	{
-		auto p = parseInt(ctx);
-		if (p.first) {
-			return make_pair(true, p.second);
-		}
-	}
-
-	{
-		auto p = substitute(ctx);
-		if (p.first) {
-			return make_pair(true, p.second);
-		}
-	}
-
-	{
-		auto p = parse<Name>(ctx);
-		if (p.first) {
-			return make_pair(true, p.second);
-		}
-	}
-
-	{
-		auto p = parse<Function>(ctx);
-		if (p.first) {
-			return make_pair(true, p.second);
-		}
-	}
-
-	{
-		auto p = parse<Application>(ctx);
-		if (p.first) {
-			return make_pair(true, p.second);
-		}
-	}
-
-	return make_pair(false, nullptr);
-}
-
-pair<bool, ExpressionP> ExpressionBuilder::parseInt(ParseContext &ctx)
+// An expression that has been started but not finished: which one, where it
+// started and in what position, and what it is made of so far
+struct ExpressionBuilder::Frame
 {
-	auto startpos = m_tokens.tellg();
-	auto flags = m_tokens.rdstate();
-
-	if (m_tokens.good() && startpos != -1) {
-		Token tok;
-		m_tokens >> tok;
-		if (!m_tokens.fail() && tok.type == Token::Type::INTLITERAL) {
-			unsigned num;
-			wstringstream(tok.val) >> num;
-			ExpressionP result = Expressions::zero;
-			for(; num > 0; --num) {
-				result = Application::create(Expressions::succ, result);
-			}
-
-			return make_pair(true, result);
-		}
-		m_tokens.setstate(flags);
-		m_tokens.seekg(startpos);
-	}
-
-	return make_pair(false, nullptr);
-}
+	enum class Kind {
+		// A symbol of the table applied to as many expressions as its arity
+		IMPLICIT,
+		// λname.body
+		FUNCTION,
+		// (func arg)
+		APPLICATION,
+		// if pred then expr else expr, or IF pred THEN expr ELSE expr
+		IF_THEN_ELSE
+	};
 
-pair<bool, ExpressionP> ExpressionBuilder::substitute(ParseContext &ctx)
+	Kind kind;
+	size_t start;
+	ParentPos ppos;
+	// The symbol, the function or the condition, and the parts after it
+	// parsed so far
+	ExpressionP head;
+	vector<ExpressionP> parts;
+	// Arguments still to parse, and where the first of them starts
+	size_t args;
+	size_t after;
+	NameP vbound;
+	bool typed;
+};
+
+pair<bool, ExpressionP> ExpressionBuilder::parseExpression(const SymbolTableP &syms)
 {
-	auto startpos = m_tokens.tellg();
-	auto flags = m_tokens.rdstate();
-
-	if (m_tokens.good() && startpos != -1) {
-		Token tok;
-		m_tokens >> tok;
-		if (!m_tokens.fail() && tok.type == Token::Type::OBJECT) {
-			auto sym = s_convert.to_bytes(tok.val);
-			auto it = ctx.syms->find(sym);
-			if (it != ctx.syms->end()) {
-				auto p = parseImplicitApplication(it->second, ctx);
-				if (p.first) {
-					return make_pair(true, p.second);
+	vector<Frame> stack;
+	// The position of the expression about to be started
+	auto ppos = ParentPos::EXPRESSION;
+	ExpressionP value;
+	auto starting = true;
+	auto failed = false;
+
+	while (true) {
+		if (starting) {
+			starting = false;
+			auto start = m_pos;
+			auto &known = parsed(start, ppos);
+			Token tok;
+			if (m_exhausted) {
+				failed = true;
+			} else if (known.generation == m_generation) {
+				failed = !known.parsed;
+				value = known.expr;
+				seek(known.end);
+			} else if (!next(tok)) {
+				failed = true;
+			} else if (tok.type == Token::Type::INTLITERAL) {
+				value = Numeral::create(literal(tok));
+			} else if (tok.type == Token::Type::OBJECT) {
+				auto sym = tok.str();
+				auto found = syms->find(sym);
+				if (!found) {
+					value = Name::create(sym);
+				} else if (found->second == 0) {
+					value = found->first;
 				} else {
-					return make_pair(true, it->second.first);
+					stack.push_back(Frame{Frame::Kind::IMPLICIT, start, ppos, found->first, {}, found->second, m_pos, nullptr, false});
+					ppos = ParentPos::EXPRESSION;
+					starting = true;
+					continue;
 				}
-			}
-		}
-		m_tokens.setstate(flags);
-		m_tokens.seekg(startpos);
-	}
-
-	return make_pair(false, nullptr);
-}
-
-template<> pair<bool, NameP> ExpressionBuilder::parse(ParseContext &ctx)
-{
-	auto startpos = m_tokens.tellg();
-	auto flags = m_tokens.rdstate();
-
-	if (m_tokens.good() && startpos != -1) {
-		Token tok;
-		m_tokens >> tok;
-		if (!m_tokens.fail() && tok.type == Token::Type::OBJECT) {
-			return make_pair(true, Name::create(s_convert.to_bytes(tok.val)));
-		}
-		m_tokens.setstate(flags);
-		m_tokens.seekg(startpos);
-	}
-
-	return make_pair(false, nullptr);
-}
-
-template<> pair<bool, FunctionP> ExpressionBuilder::parse(ParseContext &ctx)
-{
-	auto startpos = m_tokens.tellg();
-	auto flags = m_tokens.rdstate();
-
-	if (m_tokens.good() && startpos != -1) {
-		Token tok;
-		m_tokens >> tok;
-		if (m_tokens.good() && tok.type == Token::Type::LAMBDA) {
-			m_tokens >> tok;
-			if (m_tokens.good() && tok.type == Token::Type::OBJECT) {
-				auto name = s_convert.to_bytes(tok.val);
-				ParseContext c2{ctx, ParentPos::EXPRESSION};
-				m_tokens >> tok;
-				if (m_tokens.good() && tok.type == Token::Type::DOT) {
-					auto q = parse<Function>(c2);
-					if (q.first) {
-						return make_pair(true, Function::create(Name::create(name), q.second));
-					}
-					auto r = parse<Expression>(c2);
-					if (r.first) {
-						return make_pair(true, Function::create(Name::create(name), r.second));
-					}
+			} else if (tok.type == Token::Type::LAMBDA) {
+				Token dot;
+				if (next(tok) && tok.type == Token::Type::OBJECT && next(dot) && dot.type == Token::Type::DOT) {
+					auto vbound = Name::create(tok.str());
+					stack.push_back(Frame{Frame::Kind::FUNCTION, start, ppos, nullptr, {}, 0, 0, vbound, false});
+					ppos = ParentPos::EXPRESSION;
+					starting = true;
+					continue;
 				}
+				failed = true;
+			} else if (tok.type == Token::Type::L_PAREN) {
+				stack.push_back(Frame{Frame::Kind::APPLICATION, start, ppos, nullptr, {}, 0, 0, nullptr, false});
+				ppos = ParentPos::APPLICATION_EXPR;
+				starting = true;
+				continue;
+			} else if (tok.type == Token::Type::IF || tok.type == Token::Type::IF_TYPED) {
+				stack.push_back(Frame{Frame::Kind::IF_THEN_ELSE, start, ppos, nullptr, {}, 0, 0, nullptr, tok.type == Token::Type::IF_TYPED});
+				ppos = ParentPos::EXPRESSION;
+				starting = true;
+				continue;
+			} else {
+				failed = true;
 			}
 		}
-		m_tokens.setstate(flags);
-		m_tokens.seekg(startpos);
-	}
 
-	return make_pair(false, nullptr);
-}
-
-template<> pair<bool, ApplicationP> ExpressionBuilder::parse(ParseContext &ctx)
-{
-	auto startpos = m_tokens.tellg();
-	auto flags = m_tokens.rdstate();
-
-	if (m_tokens.good() && startpos != -1) {
-		Token tok;
-		m_tokens >> tok;
-		if (m_tokens.good() && tok.type == Token::Type::L_PAREN) {
-			ParseContext c2{ctx, ParentPos::APPLICATION_EXPR};
-			auto p = parse<Expression>(c2);
-			if (p.first) {
-				auto q = parse<Expression>(ctx);
-				if (m_tokens.good() && q.first) {
-					m_tokens >> tok;
-					if (!m_tokens.fail() && tok.type == Token::Type::R_PAREN) {
-						return make_pair(true, Application::create(p.second, q.second));
-					}
-				}
+		if (failed) {
+			// Everything up to the innermost implicit application fails with
+			// it, which falls back to its symbol alone
+			while (!stack.empty() && stack.back().kind != Frame::Kind::IMPLICIT) {
+				auto &frame = stack.back();
+				parsed(frame.start, frame.ppos) = Parsed{m_generation, false, nullptr, frame.start};
+				stack.pop_back();
 			}
-		}
-		m_tokens.setstate(flags);
-		m_tokens.seekg(startpos);
-	}
-
-	return make_pair(false, nullptr);
-}
-
-pair<bool, ApplicationP> ExpressionBuilder::parseImplicitApplication(const symbol_table::mapped_type &func, ParseContext &ctx)
-{
-	auto startpos = m_tokens.tellg();
-	auto flags = m_tokens.rdstate();
-
-	ExpressionP result = func.first;
-	auto nargs = func.second;
-	if (nargs >= 1) {
-		for(auto nlevel = nargs-1; true; --nlevel) {
-			ParseContext c2{ctx, ParentPos::EXPRESSION};
-			auto p = parse<Expression>(c2);
-			if (p.first) {
-				result = Application::create(result, p.second);
-				if (nlevel == 0) {
-					auto startpos = m_tokens.tellg();
-					auto flags = m_tokens.rdstate();
+			if (stack.empty()) {
+				return make_pair(false, nullptr);
+			}
+			failed = false;
+			seek(stack.back().after);
+			value = stack.back().head;
+		} else if (stack.empty()) {
+			return make_pair(true, value);
+		} else {
+			// One more part of the innermost expression
+			auto &frame = stack.back();
+			switch (frame.kind) {
+			case Frame::Kind::IMPLICIT:
+				frame.parts.push_back(value);
+				if (frame.parts.size() < frame.args) {
+					ppos = ParentPos::EXPRESSION;
+					starting = true;
+					continue;
+				} else {
+					// Inside the function of an explicit application, the
+					// application needs something left over for its argument
+					auto before = m_pos;
 					Token tok;
-					m_tokens >> tok;
-					if (ctx.ppos != ParentPos::APPLICATION_EXPR ||
-							tok.type != Token::Type::R_PAREN) {
-						m_tokens.setstate(flags);
-						m_tokens.seekg(startpos);
-						return make_pair(true, dynamic_pointer_cast<Application>(result));
+					next(tok);
+					if (frame.ppos != ParentPos::APPLICATION_EXPR || tok.type != Token::Type::R_PAREN) {
+						seek(before);
+						value = frame.head;
+						for (auto &arg: frame.parts) {
+							value = Application::create(value, arg);
+						}
 					} else {
-						break;
+						seek(frame.after);
+						value = frame.head;
 					}
 				}
-			} else {
 				break;
-			}
-		}
-	}
-
-	m_tokens.setstate(flags);
-	m_tokens.seekg(startpos);
-
-	return make_pair(false, nullptr);
-}
-
-pair<bool, ApplicationP> ExpressionBuilder::parseIfThenElse(ParseContext &ctx)
-{
-	auto startpos = m_tokens.tellg();
-	auto flags = m_tokens.rdstate();
-
-	if (m_tokens.good() && startpos != -1) {
-		Token tok;
-		m_tokens >> tok;
-		if (m_tokens.good() && tok.type == Token::Type::IF) {
-			ParseContext c2{ctx, ParentPos::EXPRESSION};
-			auto pred = parse<Expression>(c2);
-			if (m_tokens.good() && pred.first) {
-				m_tokens >> tok;
-				if (m_tokens.good() && tok.type == Token::Type::THEN) {
-					auto then_expr = parse<Expression>(c2);
-					if (m_tokens.good() && then_expr.first) {
-						m_tokens >> tok;
-						if (m_tokens.good() && tok.type == Token::Type::ELSE) {
-							auto else_expr = parse<Expression>(c2);
-							if (else_expr.first) {
-								return make_pair(true,
-									Application::create(
-										Application::create(
-											Application::create(Expressions::cond, then_expr.second),
-												else_expr.second), pred.second));
-							}
-						}
+			case Frame::Kind::FUNCTION:
+				value = Function::create(frame.vbound, value);
+				break;
+			case Frame::Kind::APPLICATION:
+				if (!frame.head) {
+					frame.head = value;
+					ppos = frame.ppos;
+					starting = true;
+					continue;
+				} else {
+					Token tok;
+					if (next(tok) && tok.type == Token::Type::R_PAREN) {
+						value = Application::create(frame.head, value);
+					} else {
+						failed = true;
+						continue;
 					}
 				}
-			}
-		}
-	}
-
-	m_tokens.setstate(flags);
-	m_tokens.seekg(startpos);
-
-	return make_pair(false, nullptr);
-}
-
-// TODO consolidate with parseIfThenElse
-pair<bool, ApplicationP> ExpressionBuilder::parseTypedIfThenElse(ParseContext &ctx)
-{
-	auto startpos = m_tokens.tellg();
-	auto flags = m_tokens.rdstate();
-
-	if (m_tokens.good() && startpos != -1) {
-		Token tok;
-		m_tokens >> tok;
-		if (m_tokens.good() && tok.type == Token::Type::IF_TYPED) {
-			ParseContext c2{ctx, ParentPos::EXPRESSION};
-			auto pred = parse<Expression>(c2);
-			if (m_tokens.good() && pred.first) {
-				m_tokens >> tok;
-				if (m_tokens.good() && tok.type == Token::Type::THEN_TYPED) {
-					auto then_expr = parse<Expression>(c2);
-					if (m_tokens.good() && then_expr.first) {
-						m_tokens >> tok;
-						if (m_tokens.good() && tok.type == Token::Type::ELSE_TYPED) {
-							auto else_expr = parse<Expression>(c2);
-							if (else_expr.first) {
-								return make_pair(true,
-									Application::create(
-										Application::create(
-											Application::create(
-												Expressions::typed_cond,
-												then_expr.second
-											),
-											else_expr.second
-										),
-										pred.second
-									)
-								);
-							}
-						}
+				break;
+			case Frame::Kind::IF_THEN_ELSE:
+				if (!frame.head || frame.parts.empty()) {
+					if (!frame.head) {
+						frame.head = value;
+					} else {
+						frame.parts.push_back(value);
 					}
+					Token tok;
+					auto expected = frame.parts.empty() ?
+						(frame.typed ? Token::Type::THEN_TYPED : Token::Type::THEN) :
+						(frame.typed ? Token::Type::ELSE_TYPED : Token::Type::ELSE);
+					if (next(tok) && tok.type == expected) {
+						ppos = ParentPos::EXPRESSION;
+						starting = true;
+					} else {
+						failed = true;
+					}
+					continue;
+				} else {
+					value = Application::create(
+						Application::create(
+							Application::create(frame.typed ? ExpressionP(Expressions::typed_cond) : ExpressionP(Expressions::cond), frame.parts[0]),
+							value
+						),
+						frame.head
+					);
 				}
+				break;
 			}
 		}
-	}
-
-	m_tokens.setstate(flags);
-	m_tokens.seekg(startpos);
 
-	return make_pair(false, nullptr);
+		// The innermost expression is complete
+		auto &frame = stack.back();
+		parsed(frame.start, frame.ppos) = Parsed{m_generation, true, value, m_pos};
+		stack.pop_back();
+	}
 }
 
-wstring_convert<codecvt_utf8<wchar_t>> ExpressionBuilder::s_convert{};
-
 } // namespace Parser
 } // namespace Lambda
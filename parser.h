@@ -4,13 +4,15 @@
 #include <istream>
 #include <codecvt>
 #include <locale>
-#include <map>
 #include <memory>
 #include <stdexcept>
 #include <string>
 #include <sstream>
+#include <vector>
 
+#include "builtins.h"
 #include "lambda.h"
+#include "symtab.h"
 
 namespace Lambda {
 namespace Parser {
@@ -36,73 +38,99 @@ struct Token
 		ELSE_TYPED
 	};
 
-	Token(): type(Token::Type::INVALID) {}
+	Token():
+		type(Token::Type::INVALID),
+		text(nullptr),
+		size(0) {}
 
-	Token(Token::Type type, const std::wstring val):
+	Token(Token::Type type, const char *text, size_t size):
 		type(type),
-		val(val) {}
+		text(text),
+		size(size) {}
+
+	// The UTF-8 bytes of the token, which stay in the text it was read from
+	std::string str() const
+	{
+		return std::string(text, size);
+	}
 
 	Token::Type type;
-	std::wstring val;
+	const char *text;
+	size_t size;
 };
 
-std::wistream &operator>>(std::wistream &is, Token &tok);
-std::wostream &operator<<(std::wostream &os, const Token &tok);
+// The tokens of the UTF-8 text from begin to end, in order, referring to it
+// rather than copying it. A character that cannot start a token becomes an
+// INVALID token of its own.
+std::vector<Token> tokenize(const char *begin, const char *end);
+
+std::ostream &operator<<(std::ostream &os, const Token &tok);
 
 enum class ParentPos {
 	EXPRESSION,
 	APPLICATION_EXPR,
 };
 
-// name -> <function, arity>
-using symbol_table = std::map<std::string, std::pair<Lambda::ExpressionP, size_t>>;
-using SymbolTableP = std::shared_ptr<symbol_table>;
-
-const symbol_table &builtins();
+const SymbolTable &builtins();
 SymbolTableP newDefaultSymTable();
 
+// Parses expressions and definitions from text that is split into tokens
+// once, up front. Every expression is decided by its first token, so no token
+// is read more than a bounded number of times, except where an implicit
+// application falls back to its symbol alone and leaves its arguments to be
+// read again: what an expression starting at a token parses to is remembered
+// for the rest of the parse1() call, so the fallback finds them parsed. The
+// expressions still open are kept on an explicit stack, however deeply they
+// nest.
 class ExpressionBuilder
 {
-	struct ParseContext {
-
-		ParseContext(SymbolTableP syms):
-			syms(syms),
-			ppos(ParentPos::EXPRESSION) {}
+public:
+	// Parses the UTF-8 text from begin to end, which has to outlive the
+	// builder
+	ExpressionBuilder(const char *begin, const char *end, SymbolTableP syms=nullptr);
 
-		ParseContext(const ParseContext &other, ParentPos ppos):
-			syms(other.syms),
-			ppos(ppos) {}
+	// Parses a copy of the text
+	ExpressionBuilder(std::wistream &is, SymbolTableP syms=nullptr);
+	ExpressionBuilder(const std::wstring &expression, SymbolTableP syms=nullptr);
+	ExpressionBuilder(const std::string &expression, SymbolTableP syms=nullptr);
 
-		SymbolTableP syms;
-		const ParentPos ppos;
-	};
+	// The tokens refer to the text
+	ExpressionBuilder(const ExpressionBuilder &) = delete;
+	ExpressionBuilder &operator=(const ExpressionBuilder &) = delete;
 
-public:
-	ExpressionBuilder(std::wistream &is, SymbolTableP syms=nullptr):
-		m_tokens(is),
-		m_syms(syms ? syms : std::make_shared<symbol_table>()) {}
+	std::pair<std::string, Lambda::ExpressionP> parse1();
 
-	ExpressionBuilder(const std::wstring &expression, SymbolTableP syms=nullptr):
-		m_ss(expression),
-		m_tokens(m_ss),
-		m_syms(syms ? syms : std::make_shared<symbol_table>()) {}
+private:
+	struct Frame;
+
+	// What the expression starting at a token parsed to in a given position,
+	// for the parse1() call of the generation it was stored in
+	struct Parsed
+	{
+		unsigned long generation;
+		bool parsed;
+		Lambda::ExpressionP expr;
+		size_t end;
+	};
 
-	std::pair<symbol_table::key_type, Lambda::ExpressionP> parse1();
+	std::pair<bool, Lambda::ExpressionP> parseExpression(const SymbolTableP &syms);
 
-private:
-	template<typename T> std::pair<bool, std::shared_ptr<T>> parse(ParseContext &);
+	// The next token, false past the last one. Asking past the last token
+	// ends the input for good, as a stream reading past its end fails: later
+	// reads fail too and going back to an earlier token does nothing.
+	bool next(Token &tok);
+	void seek(size_t pos);
 
-	std::pair<bool, Lambda::ExpressionP> parseInt(ParseContext &ctx);
-	std::pair<bool, Lambda::ExpressionP> substitute(ParseContext &ctx);
-	std::pair<bool, Lambda::ApplicationP> parseImplicitApplication(const symbol_table::mapped_type &func, ParseContext &);
-	std::pair<bool, Lambda::ApplicationP> parseIfThenElse(ParseContext &ctx);
-	std::pair<bool, Lambda::ApplicationP> parseTypedIfThenElse(ParseContext &ctx);
+	Parsed &parsed(size_t pos, ParentPos ppos);
 
-	std::wstringstream m_ss;
-	std::wistream &m_tokens;
+	const std::string m_text;
+	std::vector<Token> m_tokens;
+	size_t m_pos;
+	bool m_exhausted;
 	SymbolTableP m_syms;
 
-	static std::wstring_convert<std::codecvt_utf8<wchar_t>> s_convert;
+	std::vector<Parsed> m_parsed;
+	unsigned long m_generation;
 };
 
 } // namespace Parser
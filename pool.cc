@@ -0,0 +1,172 @@
+#include <algorithm>
+
+#include "pool.h"
+
+using std::lock_guard;
+using std::max;
+using std::memory_order_release;
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+
+namespace Lambda {
+
+namespace {
+
+// Attempts at finding a task before an idle thread goes to sleep
+const unsigned SPINS = 64;
+
+thread_local const Pool *t_pool = nullptr;
+thread_local unsigned t_index = 0;
+
+unsigned g_threads = 0;
+
+} // namespace
+
+void Pool::Task::execute()
+{
+	try {
+		run();
+	} catch (...) {
+		m_error = std::current_exception();
+	}
+	m_done.store(true, memory_order_release);
+}
+
+Pool::Pool(unsigned threads):
+	m_queued(0),
+	m_idle(0),
+	m_sleeping(0),
+	m_stop(false)
+{
+	threads = max(threads, 1u);
+	for (unsigned i = 0; i < threads; ++i) {
+		m_queues.emplace_back(new Queue);
+	}
+	for (unsigned i = 1; i < threads; ++i) {
+		m_threads.emplace_back(&Pool::work, this, i);
+	}
+}
+
+Pool::~Pool()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (auto &thread: m_threads) {
+		thread.join();
+	}
+}
+
+void Pool::spawn(Task &task)
+{
+	auto &queue = *m_queues[self()];
+	{
+		lock_guard<mutex> lock(queue.mutex);
+		queue.tasks.push_back(&task);
+		++m_queued;
+	}
+
+	// A thread going to sleep counts itself before it looks at m_queued
+	// again, so either it sees this task or it is woken
+	if (m_sleeping.load() > 0) {
+		lock_guard<mutex> lock(m_mutex);
+		m_wake.notify_one();
+	}
+}
+
+void Pool::join(Task &task)
+{
+	auto index = self();
+	while (!task.done()) {
+		if (auto other = take(index)) {
+			other->execute();
+		} else {
+			std::this_thread::yield();
+		}
+	}
+
+	if (task.m_error) {
+		std::rethrow_exception(task.m_error);
+	}
+}
+
+Pool &Pool::shared()
+{
+	static Pool pool(g_threads ? g_threads : thread::hardware_concurrency());
+	return pool;
+}
+
+void Pool::setThreads(unsigned threads)
+{
+	g_threads = threads;
+}
+
+unsigned Pool::self() const
+{
+	return t_pool == this ? t_index : 0;
+}
+
+Pool::Task *Pool::take(unsigned index)
+{
+	{
+		auto &queue = *m_queues[index];
+		lock_guard<mutex> lock(queue.mutex);
+		if (!queue.tasks.empty()) {
+			auto task = queue.tasks.back();
+			queue.tasks.pop_back();
+			--m_queued;
+			return task;
+		}
+	}
+
+	for (unsigned i = 1; i < m_queues.size(); ++i) {
+		auto &queue = *m_queues[(index + i) % m_queues.size()];
+		lock_guard<mutex> lock(queue.mutex);
+		if (!queue.tasks.empty()) {
+			auto task = queue.tasks.front();
+			queue.tasks.pop_front();
+			--m_queued;
+			return task;
+		}
+	}
+
+	return nullptr;
+}
+
+void Pool::work(unsigned index)
+{
+	t_pool = this;
+	t_index = index;
+
+	++m_idle;
+	while (true) {
+		Task *task = nullptr;
+		for (unsigned i = 0; i < SPINS && !task; ++i) {
+			task = take(index);
+			if (!task) {
+				std::this_thread::yield();
+			}
+		}
+
+		if (task) {
+			--m_idle;
+			task->execute();
+			++m_idle;
+			continue;
+		}
+
+		unique_lock<mutex> lock(m_mutex);
+		++m_sleeping;
+		m_wake.wait(lock, [this] { return m_stop || m_queued.load() > 0; });
+		--m_sleeping;
+		if (m_stop) {
+			break;
+		}
+	}
+	--m_idle;
+}
+
+} // namespace Lambda
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Lambda {
+
+// Threads running tasks spawned by the tasks they run. Every thread keeps its
+// own deque: it takes its newest task itself, and a thread that has run out of
+// work steals the oldest task of another. A thread waiting for a task to be
+// done runs other tasks in the meantime, so tasks may spawn and join freely.
+class Pool
+{
+public:
+	class Task
+	{
+	public:
+		Task():
+			m_done(false) {}
+
+		virtual ~Task() {}
+
+		Task(const Task &) = delete;
+		Task &operator=(const Task &) = delete;
+
+		// Whether join() would return at once
+		bool done() const
+		{
+			return m_done.load(std::memory_order_acquire);
+		}
+
+	protected:
+		virtual void run() = 0;
+
+	private:
+		friend class Pool;
+
+		void execute();
+
+		std::atomic<bool> m_done;
+		std::exception_ptr m_error;
+	};
+
+	// threads counts the thread that calls join(), so a pool of one thread
+	// starts none and runs every task where it is joined
+	explicit Pool(unsigned threads);
+	~Pool();
+
+	Pool(const Pool &) = delete;
+	Pool &operator=(const Pool &) = delete;
+
+	unsigned threads() const
+	{
+		return m_queues.size();
+	}
+
+	// Whether a task spawned now would likely be started by an idle thread
+	// rather than wait to be run by the one joining it
+	bool hungry() const
+	{
+		return m_idle.load() > m_queued.load();
+	}
+
+	// Queues task, which must stay alive until it has been joined
+	void spawn(Task &task);
+
+	// Waits until task is done, rethrowing what it threw
+	void join(Task &task);
+
+	// The pool shared by the engines, created with setThreads() threads
+	// the first time it is asked for
+	static Pool &shared();
+
+	// The hardware concurrency unless set before shared() is first called
+	static void setThreads(unsigned threads);
+
+private:
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Task *> tasks;
+	};
+
+	// The queue of the calling thread, the first one for threads that are
+	// not part of the pool
+	unsigned self() const;
+
+	// The newest task of queue index, or the oldest of another queue
+	Task *take(unsigned index);
+
+	void work(unsigned index);
+
+	std::vector<std::unique_ptr<Queue>> m_queues;
+	std::vector<std::thread> m_threads;
+
+	// Tasks waiting in the queues, and threads looking for one
+	std::atomic<unsigned> m_queued;
+	std::atomic<unsigned> m_idle;
+
+	// Idle threads sleep here once they have found nothing for a while
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::atomic<unsigned> m_sleeping;
+	bool m_stop;
+};
+
+} // namespace Lambda
@@ -0,0 +1,256 @@
+#include <algorithm>
+
+#include "printer.h"
+
+using std::ostream;
+using std::string;
+using std::to_string;
+
+namespace Lambda {
+
+namespace {
+
+// Written to the stream whenever the buffer holds this much
+const size_t BUFFER_SIZE = 1 << 16;
+
+// Whether expr is worth a binding of its own when it occurs more than once
+bool shareable(const Expression &expr)
+{
+	if (expr.loose()) {
+		return false;
+	}
+	if (auto num = dynamic_cast<const Numeral *>(&expr)) {
+		return num->value() > 0;
+	}
+	return dynamic_cast<const Function *>(&expr) || dynamic_cast<const Application *>(&expr);
+}
+
+} // namespace
+
+Printer::Printer(ostream &os, Mode mode):
+	m_os(os),
+	m_mode(mode)
+{
+}
+
+Printer::~Printer()
+{
+	flush();
+}
+
+void Printer::print(const ExpressionP &expr)
+{
+	if (!expr) {
+		append("<null expression>");
+		return;
+	}
+
+	if (m_mode == Mode::SHARED) {
+		label(*expr);
+		for (size_t i = 0; i < m_bindings.size(); ++i) {
+			append("let %" + to_string(i + 1) + " = ");
+			write(*m_bindings[i]);
+			append(" in ");
+		}
+	}
+	write(*expr);
+	m_labels.clear();
+	m_bindings.clear();
+}
+
+void Printer::flush()
+{
+	m_os.write(m_buffer.data(), m_buffer.size());
+	m_buffer.clear();
+}
+
+void Printer::write(const Expression &root)
+{
+	m_tasks.push_back(Task{Task::Kind::EXPRESSION, &root});
+	while (!m_tasks.empty()) {
+		auto task = m_tasks.back();
+		m_tasks.pop_back();
+		switch (task.kind) {
+		case Task::Kind::SPACE:
+			append(" ");
+			continue;
+		case Task::Kind::CLOSE:
+			append(")");
+			continue;
+		case Task::Kind::UNBIND:
+			m_names.pop_back();
+			continue;
+		case Task::Kind::EXPRESSION:
+			break;
+		}
+
+		auto expr = task.expr;
+		if (expr != &root && !m_labels.empty()) {
+			auto found = m_labels.find(expr);
+			if (found != m_labels.end()) {
+				append("%" + to_string(found->second));
+				continue;
+			}
+		}
+
+		if (auto name = dynamic_cast<const Name *>(expr)) {
+			append(name->name());
+		} else if (auto index = dynamic_cast<const Index *>(expr)) {
+			if (index->index() < m_names.size()) {
+				append(m_names[m_names.size() - 1 - index->index()]);
+			} else {
+				append("#" + to_string(index->index()));
+			}
+		} else if (auto func = dynamic_cast<const Function *>(expr)) {
+			// The written name is reused unless it would capture a free name
+			// or hide an enclosing binder the body refers to
+			auto name = func->vbound()->name();
+			auto &body = *func->body();
+			if (body.named() || std::find(m_names.begin(), m_names.end(), name) != m_names.end()) {
+				while (mentions(body, name, 1)) {
+					name = name.fresh();
+					Stats::rename();
+				}
+			}
+
+			append("λ");
+			append(name);
+			append(".");
+			m_names.push_back(name);
+			m_tasks.push_back(Task{Task::Kind::UNBIND, nullptr});
+			m_tasks.push_back(Task{Task::Kind::EXPRESSION, &body});
+		} else if (auto app = dynamic_cast<const Application *>(expr)) {
+			append("(");
+			m_tasks.push_back(Task{Task::Kind::CLOSE, nullptr});
+			m_tasks.push_back(Task{Task::Kind::EXPRESSION, app->arg().get()});
+			m_tasks.push_back(Task{Task::Kind::SPACE, nullptr});
+			m_tasks.push_back(Task{Task::Kind::EXPRESSION, app->func().get()});
+		} else if (auto num = dynamic_cast<const Numeral *>(expr)) {
+			// The binders are closed, so no renaming is ever needed
+			for (auto i = num->value(); i > 0; --i) {
+				append("λs.((s λx.λy.y) ");
+			}
+			append("λx.x");
+			for (auto i = num->value(); i > 0; --i) {
+				append(")");
+			}
+		} else if (auto prim = dynamic_cast<const Primitive *>(expr)) {
+			append(prim->name());
+		}
+	}
+}
+
+bool Printer::mentions(const Expression &expr, Symbol name, unsigned depth)
+{
+	// A closed subterm mentions name the same way wherever it occurs, so it
+	// is only looked at once
+	m_visited.clear();
+	m_pending.clear();
+	m_pending.emplace_back(&expr, depth);
+	while (!m_pending.empty()) {
+		auto node = m_pending.back().first;
+		auto at = m_pending.back().second;
+		m_pending.pop_back();
+		if (!node->named() && node->loose() <= at) {
+			continue;
+		}
+
+		if (auto var = dynamic_cast<const Name *>(node)) {
+			if (var->name() == name) {
+				return true;
+			}
+		} else if (auto index = dynamic_cast<const Index *>(node)) {
+			auto up = index->index() - at;
+			if (up < m_names.size() && m_names[m_names.size() - 1 - up] == name) {
+				return true;
+			}
+		} else if (!node->loose() && !m_visited.insert(node).second) {
+			continue;
+		} else if (auto func = dynamic_cast<const Function *>(node)) {
+			m_pending.emplace_back(func->body().get(), at + 1);
+		} else if (auto app = dynamic_cast<const Application *>(node)) {
+			m_pending.emplace_back(app->arg().get(), at);
+			m_pending.emplace_back(app->func().get(), at);
+		}
+	}
+	return false;
+}
+
+void Printer::label(const Expression &expr)
+{
+	// How many times each node is a part of another
+	m_counts.clear();
+	m_pending.clear();
+	m_pending.emplace_back(&expr, 0);
+	while (!m_pending.empty()) {
+		auto node = m_pending.back().first;
+		m_pending.pop_back();
+		const Expression *parts[2] = {nullptr, nullptr};
+		if (auto func = dynamic_cast<const Function *>(node)) {
+			parts[0] = func->body().get();
+		} else if (auto app = dynamic_cast<const Application *>(node)) {
+			parts[0] = app->func().get();
+			parts[1] = app->arg().get();
+		}
+		for (auto part: parts) {
+			if (part && ++m_counts[part] == 1) {
+				m_pending.emplace_back(part, 0);
+			}
+		}
+	}
+
+	// Depth first, a node after its parts. A node is only marked when its
+	// parts are pushed, so one reached again before that is finished first
+	// where it is reached first.
+	m_visited.clear();
+	m_pending.emplace_back(&expr, 0);
+	while (!m_pending.empty()) {
+		auto &top = m_pending.back();
+		auto node = top.first;
+		if (top.second) {
+			m_pending.pop_back();
+			if (node != &expr && m_counts[node] > 1 && shareable(*node)) {
+				m_bindings.push_back(node);
+				m_labels.emplace(node, m_bindings.size());
+			}
+			continue;
+		}
+		if (!m_visited.insert(node).second) {
+			m_pending.pop_back();
+			continue;
+		}
+		top.second = 1;
+		if (auto func = dynamic_cast<const Function *>(node)) {
+			m_pending.emplace_back(func->body().get(), 0);
+		} else if (auto app = dynamic_cast<const Application *>(node)) {
+			m_pending.emplace_back(app->arg().get(), 0);
+			m_pending.emplace_back(app->func().get(), 0);
+		}
+	}
+}
+
+void Printer::append(const char *text)
+{
+	m_buffer += text;
+	if (m_buffer.size() >= BUFFER_SIZE) {
+		flush();
+	}
+}
+
+void Printer::append(const string &text)
+{
+	m_buffer += text;
+	if (m_buffer.size() >= BUFFER_SIZE) {
+		flush();
+	}
+}
+
+void Printer::append(Symbol symbol)
+{
+	symbol.append(m_buffer);
+	if (m_buffer.size() >= BUFFER_SIZE) {
+		flush();
+	}
+}
+
+} // namespace Lambda
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "lambda.h"
+
+namespace Lambda {
+
+// Writes expressions as text. The nodes are walked from a stack of their own
+// rather than by recursion, so a term of any depth can be printed, and the
+// text is collected in a buffer that goes to the stream in large pieces.
+// Binders are printed with the names they were written with, given more "^"
+// in front where that would capture a free name or hide an enclosing binder
+// the body refers to.
+//
+// Hash-consing shares every repeated subterm in memory, but printed as a tree
+// each copy is written out in full, which can take exponentially more text
+// than the graph has nodes. With sharing, the closed subterms other than
+// variables and primitives that occur more than once are written once each as
+// bindings ahead of the term and referred to by name:
+//   let %1 = λx.x in let %2 = (%1 %1) in (%2 %2)
+// A binding only refers to those before it. Open subterms are printed in
+// place, as their text depends on the binders around them.
+class Printer
+{
+public:
+	enum class Mode {
+		TREE,
+		SHARED
+	};
+
+	explicit Printer(std::ostream &os, Mode mode=Mode::TREE);
+
+	// Flushes the buffer
+	~Printer();
+
+	Printer(const Printer &) = delete;
+	Printer &operator=(const Printer &) = delete;
+
+	void print(const ExpressionP &expr);
+
+	// Writes the buffered text to the stream
+	void flush();
+
+private:
+	// What is left to write of an expression, in reverse order
+	struct Task
+	{
+		enum class Kind {
+			EXPRESSION,
+			SPACE,
+			CLOSE,
+			// The end of the body of a binder
+			UNBIND
+		};
+
+		Kind kind;
+		const Expression *expr;
+	};
+
+	// Expr with the shared subterms in it other than itself by name
+	void write(const Expression &expr);
+
+	// Whether a variable of expr would be printed as name, inside the binders
+	// of m_names and depth more
+	bool mentions(const Expression &expr, Symbol name, unsigned depth);
+
+	// Finds the shared subterms of expr and numbers them in the order their
+	// bindings are written, each after those it contains
+	void label(const Expression &expr);
+
+	void append(const char *text);
+	void append(const std::string &text);
+	void append(Symbol symbol);
+
+	std::ostream &m_os;
+	const Mode m_mode;
+	std::string m_buffer;
+
+	// Kept between calls for their memory
+	std::vector<Task> m_tasks;
+	std::vector<Symbol> m_names;
+	std::vector<std::pair<const Expression *, unsigned>> m_pending;
+	std::unordered_set<const Expression *> m_visited;
+	std::unordered_map<const Expression *, unsigned> m_counts;
+	// The shared subterms of the expression being printed and their numbers
+	std::unordered_map<const Expression *, unsigned> m_labels;
+	std::vector<const Expression *> m_bindings;
+};
+
+} // namespace Lambda
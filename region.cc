@@ -0,0 +1,187 @@
+#include <algorithm>
+
+#include "concurrent.h"
+#include "region.h"
+
+using std::max;
+
+namespace Lambda {
+
+namespace {
+
+thread_local Region *t_current = nullptr;
+
+// Objects whose last reference was let go of by a destructor on this thread,
+// and whether a destructor further up is already destroying them. Never
+// freed, as objects in static storage may be destroyed after it.
+thread_local std::vector<std::shared_ptr<const void>> *t_released = nullptr;
+thread_local bool t_releasing = false;
+
+} // namespace
+
+Region::~Region()
+{
+	for (auto chunk: m_chunks) {
+		delete[] chunk;
+	}
+}
+
+void *Region::allocate(size_t size)
+{
+	ConcurrentLock lock(m_mutex);
+	auto cls = sizeClass(size);
+	++m_live;
+	++m_allocations;
+	m_bytes += cls * ALIGN;
+	m_peak = max(m_peak, m_bytes);
+
+	if (cls * ALIGN > LARGE) {
+		return new char[cls * ALIGN];
+	}
+	if (cls < m_free.size() && m_free[cls]) {
+		auto p = m_free[cls];
+		m_free[cls] = *static_cast<void **>(p);
+		return p;
+	}
+
+	size = cls * ALIGN;
+	if (static_cast<size_t>(m_end - m_next) < size) {
+		auto chunk_size = max(size, m_chunk_size);
+		m_chunks.push_back(new char[chunk_size]);
+		m_next = m_chunks.back();
+		m_end = m_next + chunk_size;
+	}
+
+	auto p = m_next;
+	m_next += size;
+	return p;
+}
+
+void Region::deallocate(void *p, size_t size)
+{
+	{
+		ConcurrentLock lock(m_mutex);
+		auto cls = sizeClass(size);
+		m_bytes -= cls * ALIGN;
+		if (cls * ALIGN > LARGE) {
+			delete[] static_cast<char *>(p);
+		}
+		if (--m_live != 0 || !m_released) {
+			if (cls * ALIGN > LARGE) {
+				return;
+			}
+			if (cls >= m_free.size()) {
+				m_free.resize(cls + 1, nullptr);
+			}
+			*static_cast<void **>(p) = m_free[cls];
+			m_free[cls] = p;
+			return;
+		}
+	}
+
+	// Nothing can reach the region any more
+	delete this;
+}
+
+void Region::release()
+{
+	{
+		ConcurrentLock lock(m_mutex);
+		m_released = true;
+		if (m_live != 0) {
+			return;
+		}
+	}
+
+	delete this;
+}
+
+size_t Region::live() const
+{
+	ConcurrentLock lock(m_mutex);
+	return m_live;
+}
+
+size_t Region::bytes() const
+{
+	ConcurrentLock lock(m_mutex);
+	return m_bytes;
+}
+
+size_t Region::allocations() const
+{
+	ConcurrentLock lock(m_mutex);
+	return m_allocations;
+}
+
+size_t Region::peak() const
+{
+	ConcurrentLock lock(m_mutex);
+	return m_peak;
+}
+
+Region *Region::current()
+{
+	return t_current;
+}
+
+RegionScope::RegionScope(size_t chunk_size):
+	m_region(Region::create(chunk_size)),
+	m_previous(t_current)
+{
+	t_current = m_region;
+}
+
+RegionScope::~RegionScope()
+{
+	t_current = m_previous;
+	m_region->release();
+}
+
+SharedRegionScope::SharedRegionScope(Region *region):
+	m_previous(t_current)
+{
+	t_current = region;
+}
+
+SharedRegionScope::~SharedRegionScope()
+{
+	t_current = m_previous;
+}
+
+void releaseShared(std::shared_ptr<const void> &&part)
+{
+	if (part.use_count() != 1) {
+		part.reset();
+		return;
+	}
+
+	if (!t_released) {
+		t_released = new std::vector<std::shared_ptr<const void>>;
+	}
+	t_released->push_back(std::move(part));
+	if (t_releasing) {
+		return;
+	}
+
+	t_releasing = true;
+	while (!t_released->empty()) {
+		// Whatever its destructor lets go of is queued behind it
+		auto last = std::move(t_released->back());
+		t_released->pop_back();
+	}
+	t_releasing = false;
+}
+
+HeapScope::HeapScope():
+	m_previous(t_current)
+{
+	t_current = nullptr;
+}
+
+HeapScope::~HeapScope()
+{
+	t_current = m_previous;
+}
+
+} // namespace Lambda
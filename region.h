@@ -0,0 +1,219 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace Lambda {
+
+// Bump allocator for the nodes built during one evaluation. Freed blocks are
+// kept on per-size free lists for reuse. Once the region has been released by
+// its owner, the memory goes back to the system in one go as soon as the last
+// block allocated from it is returned, so nodes may safely outlive the
+// evaluation that created them. While concurrent() holds, blocks may be
+// returned from any thread.
+class Region
+{
+public:
+	static Region *create(size_t chunk_size = 1 << 20)
+	{
+		return new Region(chunk_size);
+	}
+
+	Region(const Region &) = delete;
+	Region &operator=(const Region &) = delete;
+
+	void *allocate(size_t size);
+	void deallocate(void *p, size_t size);
+
+	// Called by the owner when no more nodes will be created in the region
+	void release();
+
+	// Blocks allocated and not yet returned, and the bytes they take up
+	size_t live() const;
+	size_t bytes() const;
+
+	// Blocks allocated so far, returned or not, and the most bytes they have
+	// taken up at once
+	size_t allocations() const;
+	size_t peak() const;
+
+	// The region nodes are currently created in on this thread, if any
+	static Region *current();
+
+private:
+	friend class RegionScope;
+
+	static const size_t ALIGN = alignof(std::max_align_t);
+
+	// Blocks bigger than this, such as the storage of a long vector, come from
+	// the heap on their own and go straight back to it
+	static const size_t LARGE = 4096;
+
+	explicit Region(size_t chunk_size):
+		m_chunk_size(chunk_size),
+		m_next(nullptr),
+		m_end(nullptr),
+		m_live(0),
+		m_bytes(0),
+		m_allocations(0),
+		m_peak(0),
+		m_released(false) {}
+
+	~Region();
+
+	static size_t sizeClass(size_t size)
+	{
+		return (size + ALIGN - 1) / ALIGN;
+	}
+
+	const size_t m_chunk_size;
+	std::vector<char *> m_chunks;
+	char *m_next;
+	char *m_end;
+	std::vector<void *> m_free;
+	size_t m_live;
+	size_t m_bytes;
+	size_t m_allocations;
+	size_t m_peak;
+	bool m_released;
+	mutable std::mutex m_mutex;
+};
+
+// Creates a region and makes the nodes created on this thread come from it for
+// the lifetime of the scope
+class RegionScope
+{
+public:
+	explicit RegionScope(size_t chunk_size = 1 << 20);
+	~RegionScope();
+
+	RegionScope(const RegionScope &) = delete;
+	RegionScope &operator=(const RegionScope &) = delete;
+
+private:
+	Region *m_region;
+	Region *m_previous;
+};
+
+// Makes the nodes created on this thread come from region, which belongs to a
+// RegionScope on another thread outliving this scope, for the lifetime of the
+// scope. Lets the threads helping with an evaluation build its nodes in its
+// region.
+class SharedRegionScope
+{
+public:
+	explicit SharedRegionScope(Region *region);
+	~SharedRegionScope();
+
+	SharedRegionScope(const SharedRegionScope &) = delete;
+	SharedRegionScope &operator=(const SharedRegionScope &) = delete;
+
+private:
+	Region *m_previous;
+};
+
+// Makes the nodes created on this thread come from the heap for the lifetime
+// of the scope, for nodes that are kept beyond the current evaluation
+class HeapScope
+{
+public:
+	HeapScope();
+	~HeapScope();
+
+	HeapScope(const HeapScope &) = delete;
+	HeapScope &operator=(const HeapScope &) = delete;
+
+private:
+	Region *m_previous;
+};
+
+// Allocates from region, or from the heap if it is null
+template<typename T>
+class RegionAllocator
+{
+public:
+	using value_type = T;
+
+	// From the current region, if there is one
+	RegionAllocator():
+		m_region(Region::current()) {}
+
+	explicit RegionAllocator(Region *region):
+		m_region(region) {}
+
+	template<typename U>
+	RegionAllocator(const RegionAllocator<U> &other):
+		m_region(other.region()) {}
+
+	T *allocate(size_t n)
+	{
+		if (!m_region) {
+			return static_cast<T *>(::operator new(n * sizeof(T)));
+		}
+		return static_cast<T *>(m_region->allocate(n * sizeof(T)));
+	}
+
+	void deallocate(T *p, size_t n)
+	{
+		if (!m_region) {
+			::operator delete(p);
+			return;
+		}
+		m_region->deallocate(p, n * sizeof(T));
+	}
+
+	Region *region() const
+	{
+		return m_region;
+	}
+
+private:
+	Region *m_region;
+};
+
+template<typename T, typename U>
+bool operator==(const RegionAllocator<T> &a, const RegionAllocator<U> &b)
+{
+	return a.region() == b.region();
+}
+
+template<typename T, typename U>
+bool operator!=(const RegionAllocator<T> &a, const RegionAllocator<U> &b)
+{
+	return !(a == b);
+}
+
+// A vector kept in the current region when it is made, if there is one, so
+// that an engine's stacks count against the memory of the evaluation
+template<typename T>
+using RegionVector = std::vector<T, RegionAllocator<T>>;
+
+// make_shared from the current region, if there is one
+template<typename T, typename... Args>
+std::shared_ptr<T> makeShared(Args&&... args)
+{
+	if (auto region = Region::current()) {
+		return std::allocate_shared<T>(RegionAllocator<T>(region), std::forward<Args>(args)...);
+	}
+	return std::make_shared<T>(std::forward<Args>(args)...);
+}
+
+// Lets go of part, the last reference to an object or not, from a destructor.
+// An object it was the last reference to is destroyed once the outermost such
+// destructor on the thread is done rather than from inside this one, so that
+// a long chain of shared objects comes apart in a loop instead of a call per
+// link.
+void releaseShared(std::shared_ptr<const void> &&part);
+
+// releaseShared for a member of an object being destroyed, which nothing reads
+// any more
+template<typename T>
+void releaseMember(const std::shared_ptr<T> &part)
+{
+	releaseShared(std::move(const_cast<std::shared_ptr<T> &>(part)));
+}
+
+} // namespace Lambda
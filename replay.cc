@@ -0,0 +1,449 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lambda.h"
+#include "trace.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::getline;
+using std::ifstream;
+using std::pair;
+using std::runtime_error;
+using std::string;
+using std::to_string;
+using std::vector;
+
+using Lambda::Application;
+using Lambda::ExpressionP;
+using Lambda::Function;
+using Lambda::Index;
+using Lambda::Name;
+using Lambda::Numeral;
+using Lambda::Primitive;
+
+namespace Trace = Lambda::Trace;
+
+namespace {
+
+// As much of JSON as a trace is written in
+struct Value
+{
+	enum class Type {
+		NUMBER,
+		STRING,
+		ARRAY,
+		OBJECT,
+		OTHER
+	};
+
+	Type type;
+	long long number;
+	string text;
+	vector<Value> items;
+	vector<pair<string, Value>> members;
+
+	// The member called key, if this is an object that has one
+	const Value *get(const string &key) const
+	{
+		for (auto &member: members) {
+			if (member.first == key) {
+				return &member.second;
+			}
+		}
+		return nullptr;
+	}
+};
+
+class JsonReader
+{
+public:
+	explicit JsonReader(const string &text):
+		m_text(text),
+		m_pos(0) {}
+
+	Value parse()
+	{
+		auto value = parseValue();
+		skipSpace();
+		if (m_pos != m_text.size()) {
+			fail("trailing characters");
+		}
+		return value;
+	}
+
+private:
+	Value parseValue()
+	{
+		skipSpace();
+		Value value{Value::Type::OTHER, 0, string{}, {}, {}};
+		if (m_pos == m_text.size()) {
+			fail("value expected");
+		}
+
+		auto c = m_text[m_pos];
+		if (c == '{') {
+			value.type = Value::Type::OBJECT;
+			++m_pos;
+			skipSpace();
+			if (!eat('}')) {
+				do {
+					skipSpace();
+					auto key = parseString();
+					skipSpace();
+					expect(':');
+					value.members.emplace_back(key, parseValue());
+					skipSpace();
+				} while (eat(','));
+				expect('}');
+			}
+		} else if (c == '[') {
+			value.type = Value::Type::ARRAY;
+			++m_pos;
+			skipSpace();
+			if (!eat(']')) {
+				do {
+					value.items.push_back(parseValue());
+					skipSpace();
+				} while (eat(','));
+				expect(']');
+			}
+		} else if (c == '"') {
+			value.type = Value::Type::STRING;
+			value.text = parseString();
+		} else if (c == '-' || (c >= '0' && c <= '9')) {
+			value.type = Value::Type::NUMBER;
+			char *end;
+			if (c == '-') {
+				value.number = std::strtoll(m_text.c_str() + m_pos, &end, 10);
+			} else {
+				// Numerals go up to the largest unsigned long, and are kept
+				// by their bits
+				value.number = static_cast<long long>(std::strtoull(m_text.c_str() + m_pos, &end, 10));
+			}
+			m_pos = end - m_text.c_str();
+		} else {
+			// true, false or null, which no record has
+			while (m_pos < m_text.size() && m_text[m_pos] >= 'a' && m_text[m_pos] <= 'z') {
+				++m_pos;
+			}
+		}
+		return value;
+	}
+
+	string parseString()
+	{
+		expect('"');
+		string text;
+		while (m_pos < m_text.size() && m_text[m_pos] != '"') {
+			auto c = m_text[m_pos++];
+			if (c != '\\') {
+				text += c;
+				continue;
+			}
+			if (m_pos == m_text.size()) {
+				break;
+			}
+			c = m_text[m_pos++];
+			if (c == 'u') {
+				// Only control characters are escaped this way
+				text += static_cast<char>(std::strtol(m_text.substr(m_pos, 4).c_str(), nullptr, 16));
+				m_pos += 4;
+			} else if (c == 'n') {
+				text += '\n';
+			} else if (c == 't') {
+				text += '\t';
+			} else {
+				text += c;
+			}
+		}
+		expect('"');
+		return text;
+	}
+
+	void skipSpace()
+	{
+		while (m_pos < m_text.size() && (m_text[m_pos] == ' ' || m_text[m_pos] == '\t' || m_text[m_pos] == '\r')) {
+			++m_pos;
+		}
+	}
+
+	bool eat(char c)
+	{
+		if (m_pos < m_text.size() && m_text[m_pos] == c) {
+			++m_pos;
+			return true;
+		}
+		return false;
+	}
+
+	void expect(char c)
+	{
+		if (!eat(c)) {
+			fail(string("'") + c + "' expected");
+		}
+	}
+
+	void fail(const string &what)
+	{
+		throw runtime_error("Bad JSON at column " + to_string(m_pos + 1) + ": " + what);
+	}
+
+	const string &m_text;
+	size_t m_pos;
+};
+
+const Value &member(const Value &record, const string &key)
+{
+	auto value = record.get(key);
+	if (!value) {
+		throw runtime_error("Record without \"" + key + "\"");
+	}
+	return *value;
+}
+
+// The term of a snapshot record
+ExpressionP decode(const Value &snapshot)
+{
+	vector<ExpressionP> nodes;
+	auto node = [&](const Value &id) {
+		if (id.type != Value::Type::NUMBER || id.number < 0 || static_cast<size_t>(id.number) >= nodes.size()) {
+			throw runtime_error("Snapshot refers to a node not listed before");
+		}
+		return nodes[id.number];
+	};
+
+	for (auto &item: snapshot.items) {
+		if (item.items.size() < 2 || item.items[0].type != Value::Type::STRING) {
+			throw runtime_error("Bad snapshot node");
+		}
+		auto &kind = item.items[0].text;
+		auto &first = item.items[1];
+		if (kind == "v") {
+			nodes.push_back(Name::create(first.text));
+		} else if (kind == "i") {
+			nodes.push_back(Index::create(first.number));
+		} else if (kind == "l" && item.items.size() == 3) {
+			nodes.push_back(Function::fromIndexed(Name::create(first.text), node(item.items[2])));
+		} else if (kind == "a" && item.items.size() == 3) {
+			nodes.push_back(Application::create(node(first), node(item.items[2])));
+		} else if (kind == "n") {
+			nodes.push_back(Numeral::create(static_cast<unsigned long>(first.number)));
+		} else if (kind == "p") {
+			ExpressionP prim;
+			for (auto op = 0; op <= static_cast<int>(Primitive::Op::EQUAL); ++op) {
+				auto candidate = Primitive::create(static_cast<Primitive::Op>(op));
+				if (candidate->name() == first.text) {
+					prim = candidate;
+				}
+			}
+			if (!prim) {
+				throw runtime_error("Unknown primitive \"" + first.text + "\"");
+			}
+			nodes.push_back(prim);
+		} else {
+			throw runtime_error("Bad snapshot node \"" + kind + "\"");
+		}
+	}
+
+	if (nodes.empty()) {
+		throw runtime_error("Empty snapshot");
+	}
+	return nodes.back();
+}
+
+// A step record applied to term, checking the change in size it records
+ExpressionP replay(const ExpressionP &term, const Value &record)
+{
+	Trace::Rule rule;
+	auto &name = member(record, "rule").text;
+	if (!Trace::ruleNamed(name, rule)) {
+		throw runtime_error("Unknown rule \"" + name + "\"");
+	}
+
+	auto reduced = Trace::rewrite(term, member(record, "path").text, rule);
+	if (static_cast<long long>(reduced->size()) - term->size() != member(record, "delta").number) {
+		throw runtime_error("Size changed by other than the recorded delta");
+	}
+	return reduced;
+}
+
+// Reads the records of a trace one by one
+class TraceFile
+{
+public:
+	explicit TraceFile(const string &file):
+		m_in(file),
+		m_line(0)
+	{
+		if (!m_in) {
+			throw runtime_error("File \"" + file + "\" does not exist");
+		}
+	}
+
+	bool next(Value &record)
+	{
+		string line;
+		while (getline(m_in, line)) {
+			++m_line;
+			if (!line.empty()) {
+				record = JsonReader(line).parse();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Where the last record was read, for messages
+	string where() const
+	{
+		return "line " + to_string(m_line);
+	}
+
+private:
+	ifstream m_in;
+	unsigned long m_line;
+};
+
+// One line per evaluation: its number, engine, steps, status and expression
+void list(const string &file)
+{
+	TraceFile trace(file);
+	Value record;
+	string header;
+	while (trace.next(record)) {
+		if (auto eval = record.get("eval")) {
+			header = to_string(eval->number) + " " + member(record, "engine").text;
+			header += "\t" + member(record, "expression").text;
+		} else if (record.get("end")) {
+			auto line = header;
+			auto tab = line.find('\t');
+			line.insert(tab, " " + to_string(member(record, "steps").number) + " steps " + member(record, "status").text);
+			cout << line << endl;
+		}
+	}
+}
+
+// The term of evaluation eval after step steps, replayed from the last
+// snapshot at or before it
+ExpressionP reconstruct(const string &file, long long eval, long long step)
+{
+	TraceFile trace(file);
+	Value record;
+	long long current = 0;
+	ExpressionP term;
+	vector<Value> pending;
+
+	while (trace.next(record)) {
+		if (auto number = record.get("eval")) {
+			current = number->number;
+			continue;
+		}
+		if (current != eval) {
+			continue;
+		}
+
+		if (record.get("end")) {
+			if (member(record, "steps").number < step) {
+				throw runtime_error("Evaluation " + to_string(eval) + " took only " + to_string(member(record, "steps").number) + " steps");
+			}
+			break;
+		}
+
+		auto at = member(record, "step").number;
+		if (at > step) {
+			break;
+		}
+		if (auto snapshot = record.get("snapshot")) {
+			term = decode(*snapshot);
+			pending.clear();
+		} else {
+			pending.push_back(record);
+		}
+	}
+
+	if (!term) {
+		throw runtime_error("No evaluation " + to_string(eval) + " in \"" + file + "\"");
+	}
+	for (auto &record: pending) {
+		term = replay(term, record);
+	}
+	return term;
+}
+
+// Replays every step of every evaluation, comparing the terms with the
+// snapshots. Returns whether they all agree.
+bool check(const string &file)
+{
+	TraceFile trace(file);
+	Value record;
+	long long eval = 0;
+	ExpressionP term;
+	auto good = true;
+	// Nothing more of an evaluation can be checked after a step that fails
+	auto broken = false;
+
+	while (trace.next(record)) {
+		try {
+			if (auto number = record.get("eval")) {
+				eval = number->number;
+				term = nullptr;
+				broken = false;
+			} else if (broken) {
+				continue;
+			} else if (record.get("end")) {
+				cout << "Evaluation " << eval << ": " << member(record, "steps").number << " steps replayed" << endl;
+			} else if (auto snapshot = record.get("snapshot")) {
+				auto taken = decode(*snapshot);
+				if (term && taken != term) {
+					throw runtime_error("Snapshot differs from the term replayed");
+				}
+				term = taken;
+			} else if (!term) {
+				throw runtime_error("Step before the first snapshot");
+			} else {
+				term = replay(term, record);
+			}
+		} catch (const runtime_error &e) {
+			cerr << trace.where() << ", evaluation " << eval << ": " << e.what() << endl;
+			good = false;
+			broken = true;
+		}
+	}
+	return good;
+}
+
+} // namespace
+
+// Reads a trace written by lambda --trace. It lists the evaluations in it,
+// prints the term an evaluation had reached after a given step, or replays
+// the whole trace against its own snapshots.
+int main(int argc, char *argv[])
+{
+	vector<string> args(argv + 1, argv + argc);
+	try {
+		if (args.size() == 2 && args[0] == "--check") {
+			return check(args[1]) ? 0 : 1;
+		} else if (args.size() == 1) {
+			list(args[0]);
+			return 0;
+		} else if (args.size() == 3) {
+			auto term = reconstruct(args[0], std::atoll(args[1].c_str()), std::atoll(args[2].c_str()));
+			cout << term << endl;
+			return 0;
+		}
+	} catch (const runtime_error &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+
+	cerr << "Usage: lambda-replay TRACE [EVAL STEP]" << endl;
+	cerr << "       lambda-replay --check TRACE" << endl;
+	return 1;
+}
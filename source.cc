@@ -0,0 +1,173 @@
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "source.h"
+
+using std::istreambuf_iterator;
+using std::runtime_error;
+using std::string;
+
+namespace Lambda {
+
+namespace {
+
+bool isSpace(char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// The first newline, "\" or "-" from begin on, or end
+const char *findBreak(const char *begin, const char *end)
+{
+	auto p = begin;
+#ifdef __SSE2__
+	const auto newline = _mm_set1_epi8('\n');
+	const auto backslash = _mm_set1_epi8('\\');
+	const auto dash = _mm_set1_epi8('-');
+	for (; end - p >= 16; p += 16) {
+		auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+		auto found = _mm_or_si128(_mm_or_si128(
+			_mm_cmpeq_epi8(bytes, newline),
+			_mm_cmpeq_epi8(bytes, backslash)),
+			_mm_cmpeq_epi8(bytes, dash));
+		if (auto mask = _mm_movemask_epi8(found)) {
+			return p + __builtin_ctz(mask);
+		}
+	}
+#endif
+	for (; p != end; ++p) {
+		if (*p == '\n' || *p == '\\' || *p == '-') {
+			return p;
+		}
+	}
+	return end;
+}
+
+// The newline ending the line begin is on, or null if there is none
+const char *lineEnd(const char *begin, const char *end)
+{
+	return static_cast<const char *>(std::memchr(begin, '\n', end - begin));
+}
+
+} // namespace
+
+SourceFile::SourceFile(const string &path):
+	m_data(nullptr),
+	m_size(0),
+	m_mapped(false)
+{
+	auto fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw runtime_error("File \"" + path + "\" does not exist");
+	}
+
+	struct stat st;
+	if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		auto data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			::madvise(data, st.st_size, MADV_SEQUENTIAL);
+			m_data = static_cast<const char *>(data);
+			m_size = st.st_size;
+			m_mapped = true;
+		}
+	}
+	::close(fd);
+
+	if (!m_mapped) {
+		std::ifstream in(path, std::ios::binary);
+		m_buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+		m_data = m_buffer.data();
+		m_size = m_buffer.size();
+	}
+}
+
+SourceFile::~SourceFile()
+{
+	if (m_mapped) {
+		::munmap(const_cast<char *>(m_data), m_size);
+	}
+}
+
+bool SourceLines::next(const char *&begin, const char *&end)
+{
+	m_joined.clear();
+	auto joined = false;
+
+	while (true) {
+		auto start = m_pos;
+		auto p = start;
+		while (true) {
+			p = findBreak(p, m_end);
+			if (p == m_end || *p != '-' || (p + 1 != m_end && p[1] == '-')) {
+				break;
+			}
+			// A minus sign of its own
+			++p;
+		}
+
+		// The line ends at its newline, and a comment or a "\" end what
+		// there is of it before the newline
+		auto newline = p != m_end && *p == '\n' ? p : p == m_end ? nullptr : lineEnd(p, m_end);
+		if (!newline) {
+			m_pos = m_end;
+			return false;
+		}
+		m_pos = newline + 1;
+
+		if (p == m_end || *p != '\\') {
+			if (!joined) {
+				begin = start;
+				end = p;
+				return true;
+			}
+			m_joined.append(start, p);
+			begin = m_joined.data();
+			end = begin + m_joined.size();
+			return true;
+		}
+
+		m_joined.append(start, p);
+		joined = true;
+	}
+}
+
+const char *skipSpace(const char *begin, const char *end)
+{
+	auto p = begin;
+#ifdef __SSE2__
+	const auto space = _mm_set1_epi8(' ');
+	const auto tab = _mm_set1_epi8('\t');
+	const auto range = _mm_set1_epi8('\r' - '\t');
+	for (; end - p >= 16; p += 16) {
+		auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+		// Tab to carriage return are the bytes no more than four above tab,
+		// compared without sign
+		auto controls = _mm_sub_epi8(bytes, tab);
+		auto blank = _mm_or_si128(
+			_mm_cmpeq_epi8(bytes, space),
+			_mm_cmpeq_epi8(_mm_min_epu8(controls, range), controls));
+		auto mask = _mm_movemask_epi8(blank) ^ 0xffff;
+		if (mask) {
+			return p + __builtin_ctz(mask);
+		}
+	}
+#endif
+	while (p != end && isSpace(*p)) {
+		++p;
+	}
+	return p;
+}
+
+} // namespace Lambda
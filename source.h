@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace Lambda {
+
+// The bytes of a file, mapped into memory when it can be and read in when it
+// cannot, such as from a pipe. They stay put for the lifetime of the object.
+class SourceFile
+{
+public:
+	// Throws runtime_error if the file cannot be opened
+	explicit SourceFile(const std::string &path);
+	~SourceFile();
+
+	SourceFile(const SourceFile &) = delete;
+	SourceFile &operator=(const SourceFile &) = delete;
+
+	const char *begin() const
+	{
+		return m_data;
+	}
+
+	const char *end() const
+	{
+		return m_data + m_size;
+	}
+
+private:
+	const char *m_data;
+	size_t m_size;
+	bool m_mapped;
+	std::string m_buffer;
+};
+
+// Splits UTF-8 source text into the lines that are parsed one at a time. A
+// "--" starts a comment that runs to the end of the line, and a "\" ends the
+// line there and carries it on with the next one. As with getline, a last
+// line that no newline ends is not read. The text is searched for these a
+// vector at a time.
+class SourceLines
+{
+public:
+	SourceLines(const char *begin, const char *end):
+		m_pos(begin),
+		m_end(end) {}
+
+	// The next line, false if there is none. The bytes are those of the text,
+	// unless the line was carried on, when they are joined in a buffer that
+	// lasts until the next call.
+	bool next(const char *&begin, const char *&end);
+
+private:
+	const char *m_pos;
+	const char *const m_end;
+	std::string m_joined;
+};
+
+// The first byte from begin on that is not ASCII white space, or end
+const char *skipSpace(const char *begin, const char *end);
+
+} // namespace Lambda
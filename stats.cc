@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <mutex>
+
+#include "concurrent.h"
+#include "stats.h"
+
+using std::max;
+using std::mutex;
+
+namespace Lambda {
+namespace Stats {
+
+namespace {
+
+thread_local Counters t_local = {};
+thread_local const Scope *t_scope = nullptr;
+
+// Taken by the scopes of different threads adding to the same counters
+mutex g_lock;
+
+} // namespace
+
+void Counters::add(const Counters &other)
+{
+	beta += other.beta;
+	delta += other.delta;
+	renames += other.renames;
+	for (unsigned i = 0; i < NODE_KINDS; ++i) {
+		nodes[i] += other.nodes[i];
+	}
+	max_size = max(max_size, other.max_size);
+	max_depth = max(max_depth, other.max_depth);
+}
+
+Counters &local()
+{
+	return t_local;
+}
+
+void created(Node kind, unsigned size, unsigned depth)
+{
+	auto &counters = t_local;
+	++counters.nodes[static_cast<unsigned>(kind)];
+	counters.max_size = max(counters.max_size, size);
+	counters.max_depth = max(counters.max_depth, depth);
+}
+
+Scope::Scope(Counters *counters):
+	m_counters(counters),
+	m_previous(t_scope),
+	m_outer(t_local)
+{
+	t_local = Counters{};
+	t_scope = this;
+}
+
+Scope::~Scope()
+{
+	if (m_counters) {
+		ConcurrentLock lock(g_lock);
+		m_counters->add(t_local);
+	}
+	t_local = m_outer;
+	t_scope = m_previous;
+}
+
+const Scope *Scope::current()
+{
+	return t_scope;
+}
+
+} // namespace Stats
+} // namespace Lambda
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+
+namespace Lambda {
+namespace Stats {
+
+// The kinds of Expression node
+enum class Node {
+	NAME,
+	INDEX,
+	FUNCTION,
+	APPLICATION,
+	NUMERAL,
+	PRIMITIVE
+};
+
+const unsigned NODE_KINDS = 6;
+
+// What reducing an expression has taken. Every thread counts into its own
+// counters as it goes, which the scope collecting them adds up when it ends,
+// so counting costs an increment.
+struct Counters
+{
+	// Beta steps, in whatever form the engine takes them
+	unsigned long beta;
+	// Builtins given their result
+	unsigned long delta;
+	// Binders printed with another name than they were written with, to
+	// keep them apart from a variable they would capture
+	unsigned long renames;
+	// Nodes created rather than found already built, by kind
+	unsigned long nodes[NODE_KINDS];
+	// The largest and the deepest node created, as a tree
+	unsigned max_size;
+	unsigned max_depth;
+
+	void add(const Counters &other);
+};
+
+// The counters of this thread since the innermost scope started
+Counters &local();
+
+inline void beta()
+{
+	++local().beta;
+}
+
+inline void delta()
+{
+	++local().delta;
+}
+
+inline void rename()
+{
+	++local().renames;
+}
+
+void created(Node kind, unsigned size, unsigned depth);
+
+// Collects what this thread counts into counters for the lifetime of the
+// scope, dropping it if counters is null. The counts of an enclosing scope are
+// put aside meanwhile, and scopes on other threads may collect into the same
+// counters.
+class Scope
+{
+public:
+	explicit Scope(Counters *counters);
+	~Scope();
+
+	Scope(const Scope &) = delete;
+	Scope &operator=(const Scope &) = delete;
+
+	Counters *counters() const
+	{
+		return m_counters;
+	}
+
+	// The scope in force on this thread, if any
+	static const Scope *current();
+
+private:
+	Counters *const m_counters;
+	const Scope *const m_previous;
+	Counters m_outer;
+};
+
+} // namespace Stats
+} // namespace Lambda
@@ -0,0 +1,104 @@
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "concurrent.h"
+#include "symbol.h"
+
+using std::mutex;
+using std::ostream;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+namespace Lambda {
+
+namespace {
+
+struct SymbolEntry
+{
+	// Index of the interned string and how many "^" precede it
+	unsigned text;
+	unsigned carets;
+	// Id of the symbol returned by fresh(), zero until first asked for
+	unsigned fresh;
+};
+
+struct SymbolTable
+{
+	vector<string> texts;
+	unordered_map<string, unsigned> ids;
+	vector<SymbolEntry> entries;
+	mutex lock;
+};
+
+// Never destroyed, like the expressions naming its symbols
+SymbolTable &symbols()
+{
+	static auto table = new SymbolTable;
+	return *table;
+}
+
+} // namespace
+
+Symbol Symbol::intern(const string &name)
+{
+	auto &table = symbols();
+	ConcurrentLock lock(table.lock);
+	auto it = table.ids.find(name);
+	if (it != table.ids.end()) {
+		return Symbol(it->second);
+	}
+
+	unsigned id = table.entries.size();
+	table.entries.push_back(SymbolEntry{static_cast<unsigned>(table.texts.size()), 0, 0});
+	table.texts.push_back(name);
+	table.ids.emplace(name, id);
+	return Symbol(id);
+}
+
+Symbol Symbol::fresh() const
+{
+	auto &table = symbols();
+	ConcurrentLock lock(table.lock);
+	if (auto id = table.entries[m_id].fresh) {
+		return Symbol(id);
+	}
+
+	unsigned id = table.entries.size();
+	auto entry = table.entries[m_id];
+	table.entries.push_back(SymbolEntry{entry.text, entry.carets + 1, 0});
+	table.entries[m_id].fresh = id;
+	return Symbol(id);
+}
+
+string Symbol::str() const
+{
+	auto &table = symbols();
+	ConcurrentLock lock(table.lock);
+	auto &entry = table.entries[m_id];
+	return string(entry.carets, '^') + table.texts[entry.text];
+}
+
+void Symbol::append(string &text) const
+{
+	auto &table = symbols();
+	ConcurrentLock lock(table.lock);
+	auto &entry = table.entries[m_id];
+	text.append(entry.carets, '^');
+	text += table.texts[entry.text];
+}
+
+ostream &operator<<(ostream &os, const Symbol &symbol)
+{
+	auto &table = symbols();
+	ConcurrentLock lock(table.lock);
+	auto &entry = table.entries[symbol.m_id];
+	for (unsigned i = 0; i < entry.carets; ++i) {
+		os << '^';
+	}
+	os << table.texts[entry.text];
+	return os;
+}
+
+} // namespace Lambda
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+
+namespace Lambda {
+
+// An interned variable name. Symbols compare as integers, and the renamed
+// variants made to avoid capture are derived from an existing symbol without
+// building a new string.
+class Symbol
+{
+public:
+	static Symbol intern(const std::string &name);
+
+	// The symbol printed as name with one more "^" in front
+	Symbol fresh() const;
+
+	std::string str() const;
+
+	// Appends the symbol as printed to text
+	void append(std::string &text) const;
+
+	unsigned id() const
+	{
+		return m_id;
+	}
+
+	bool operator==(const Symbol &other) const
+	{
+		return m_id == other.m_id;
+	}
+
+	bool operator!=(const Symbol &other) const
+	{
+		return m_id != other.m_id;
+	}
+
+private:
+	friend std::ostream &operator<<(std::ostream &os, const Symbol &symbol);
+
+	explicit Symbol(unsigned id):
+		m_id(id) {}
+
+	unsigned m_id;
+};
+
+std::ostream &operator<<(std::ostream &os, const Symbol &symbol);
+
+} // namespace Lambda
@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+
+#include "symtab.h"
+
+using std::make_shared;
+using std::move;
+using std::out_of_range;
+using std::string;
+using std::vector;
+
+namespace Lambda {
+namespace Parser {
+
+namespace {
+
+// Each level of the trie takes this many bits of the hash, for 32 slots
+const unsigned BITS = 5;
+const unsigned HASH_BITS = sizeof(size_t) * 8;
+
+unsigned slot(size_t hash, unsigned shift)
+{
+	return (hash >> shift) & ((1u << BITS) - 1);
+}
+
+// Where the slot of bit goes among those map has in use
+unsigned index(uint32_t map, uint32_t bit)
+{
+	return __builtin_popcount(map & (bit - 1));
+}
+
+size_t hashOf(const string &name)
+{
+	return std::hash<string>()(name);
+}
+
+} // namespace
+
+// The slots in use hold either an entry or a subtrie for the entries whose
+// hashes agree so far, and each kind is kept in the order of its slots. Below
+// the last level, where the whole hash has been used, a node is a list of
+// entries whose hashes are all the same.
+struct SymbolTable::Node
+{
+	struct Item
+	{
+		size_t hash;
+		Entry entry;
+	};
+
+	uint32_t datamap = 0;
+	uint32_t nodemap = 0;
+	vector<Item> items;
+	vector<NodeP> children;
+
+	// A node for two entries whose hashes agree up to shift
+	static NodeP pair(Item &&a, Item &&b, unsigned shift)
+	{
+		auto node = make_shared<Node>();
+		if (shift >= HASH_BITS) {
+			node->items.push_back(move(a));
+			node->items.push_back(move(b));
+			return node;
+		}
+
+		auto bitA = 1u << slot(a.hash, shift);
+		auto bitB = 1u << slot(b.hash, shift);
+		if (bitA == bitB) {
+			node->nodemap = bitA;
+			node->children.push_back(pair(move(a), move(b), shift + BITS));
+		} else {
+			node->datamap = bitA | bitB;
+			if (bitA > bitB) {
+				std::swap(a, b);
+			}
+			node->items.push_back(move(a));
+			node->items.push_back(move(b));
+		}
+		return node;
+	}
+
+	// A copy of node along the path to item with item in it. Added is set if
+	// its name was not there before.
+	static NodeP insert(const Node &node, Item &&item, unsigned shift, bool &added)
+	{
+		auto copy = make_shared<Node>(node);
+		if (shift >= HASH_BITS) {
+			for (auto &existing: copy->items) {
+				if (existing.entry.first == item.entry.first) {
+					existing.entry.second = move(item.entry.second);
+					return copy;
+				}
+			}
+			copy->items.push_back(move(item));
+			added = true;
+			return copy;
+		}
+
+		auto bit = 1u << slot(item.hash, shift);
+		if (node.datamap & bit) {
+			auto i = index(node.datamap, bit);
+			auto &existing = copy->items[i];
+			if (existing.hash == item.hash && existing.entry.first == item.entry.first) {
+				existing.entry.second = move(item.entry.second);
+				return copy;
+			}
+			// The two move down a level together
+			auto child = pair(move(existing), move(item), shift + BITS);
+			copy->items.erase(copy->items.begin() + i);
+			copy->datamap ^= bit;
+			copy->children.insert(copy->children.begin() + index(copy->nodemap, bit), child);
+			copy->nodemap |= bit;
+			added = true;
+		} else if (node.nodemap & bit) {
+			auto i = index(node.nodemap, bit);
+			copy->children[i] = insert(*node.children[i], move(item), shift + BITS, added);
+		} else {
+			copy->items.insert(copy->items.begin() + index(node.datamap, bit), move(item));
+			copy->datamap |= bit;
+			added = true;
+		}
+		return copy;
+	}
+
+	void collect(vector<Entry> &entries) const
+	{
+		for (auto &item: items) {
+			entries.push_back(item.entry);
+		}
+		for (auto &child: children) {
+			child->collect(entries);
+		}
+	}
+};
+
+SymbolTable::SymbolTable():
+	m_root(make_shared<Node>()),
+	m_size(0)
+{
+}
+
+SymbolTable::SymbolTable(std::initializer_list<Entry> entries):
+	SymbolTable()
+{
+	for (auto &entry: entries) {
+		set(entry.first, entry.second);
+	}
+}
+
+const SymbolTable::Value *SymbolTable::find(const string &name) const
+{
+	auto hash = hashOf(name);
+	auto node = m_root.get();
+	for (unsigned shift = 0; shift < HASH_BITS; shift += BITS) {
+		auto bit = 1u << slot(hash, shift);
+		if (node->datamap & bit) {
+			auto &item = node->items[index(node->datamap, bit)];
+			return item.hash == hash && item.entry.first == name ? &item.entry.second : nullptr;
+		}
+		if (!(node->nodemap & bit)) {
+			return nullptr;
+		}
+		node = node->children[index(node->nodemap, bit)].get();
+	}
+
+	for (auto &item: node->items) {
+		if (item.entry.first == name) {
+			return &item.entry.second;
+		}
+	}
+	return nullptr;
+}
+
+const SymbolTable::Value &SymbolTable::at(const string &name) const
+{
+	auto value = find(name);
+	if (!value) {
+		throw out_of_range("No symbol \"" + name + "\"");
+	}
+	return *value;
+}
+
+SymbolTable SymbolTable::with(const string &name, const Value &value) const
+{
+	auto added = false;
+	auto root = Node::insert(*m_root, Node::Item{hashOf(name), Entry(name, value)}, 0, added);
+	return SymbolTable(root, m_size + added);
+}
+
+vector<SymbolTable::Entry> SymbolTable::entries() const
+{
+	vector<Entry> entries;
+	entries.reserve(m_size);
+	m_root->collect(entries);
+	std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+		return a.first < b.first;
+	});
+	return entries;
+}
+
+} // namespace Parser
+} // namespace Lambda
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lambda.h"
+
+namespace Lambda {
+namespace Parser {
+
+// name -> <function, arity>, as a hash array mapped trie. Tables are values:
+// adding a name makes a new table that shares all but the path to the new
+// entry with the old one, so copying a table costs nothing and a definition
+// costs O(log n). Nodes are never changed once built, so any number of
+// threads can read a table, and a copy of it, at the same time.
+class SymbolTable
+{
+public:
+	using Value = std::pair<ExpressionP, size_t>;
+	using Entry = std::pair<std::string, Value>;
+
+	SymbolTable();
+	SymbolTable(std::initializer_list<Entry> entries);
+
+	// The value of name, null if it has none
+	const Value *find(const std::string &name) const;
+
+	// Throws std::out_of_range if name has no value
+	const Value &at(const std::string &name) const;
+
+	// This table with name given value, in place of any it had
+	SymbolTable with(const std::string &name, const Value &value) const;
+
+	void set(const std::string &name, const Value &value)
+	{
+		*this = with(name, value);
+	}
+
+	size_t size() const
+	{
+		return m_size;
+	}
+
+	// Every entry, in order of name
+	std::vector<Entry> entries() const;
+
+private:
+	struct Node;
+	using NodeP = std::shared_ptr<const Node>;
+
+	SymbolTable(NodeP root, size_t size):
+		m_root(std::move(root)),
+		m_size(size) {}
+
+	NodeP m_root;
+	size_t m_size;
+};
+
+using SymbolTableP = std::shared_ptr<SymbolTable>;
+
+} // namespace Parser
+} // namespace Lambda
@@ -0,0 +1,47 @@
+#include <vector>
+
+#include "region.h"
+#include "term.h"
+
+using std::vector;
+
+namespace Lambda {
+namespace Terms {
+
+ExpressionP build(const Cell *cells, size_t size)
+{
+	HeapScope heap;
+
+	vector<ExpressionP> stack;
+	for (auto cell = cells; cell != cells + size; ++cell) {
+		switch (cell->kind) {
+		case Cell::INDEX:
+			stack.push_back(Index::create(cell->index));
+			break;
+		case Cell::NAME:
+			stack.push_back(Name::create(cell->name));
+			break;
+		case Cell::FUNCTION:
+			stack.back() = Function::fromIndexed(Name::create(cell->name), stack.back());
+			break;
+		case Cell::NUMERAL:
+			stack.push_back(Numeral::create(cell->index));
+			break;
+		case Cell::PRIMITIVE:
+			stack.push_back(Primitive::create(static_cast<Primitive::Op>(cell->index)));
+			break;
+		case Cell::APPLICATION:
+			{
+				auto arg = stack.back();
+				stack.pop_back();
+				stack.back() = Application::create(stack.back(), arg);
+			}
+			break;
+		}
+	}
+
+	return stack.back();
+}
+
+} // namespace Terms
+} // namespace Lambda
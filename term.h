@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cstddef>
+
+#include "lambda.h"
+
+namespace Lambda {
+namespace Terms {
+
+// Terms written as C++ types, compiled into read-only tables of cells and
+// turned into expressions on first use. Variables are tag types declared with
+// LAMBDA_VARIABLE, and
+//
+//     Lam<x, y, Body>    is λx.λy.Body
+//     App<f, a, b>       is ((f a) b)
+//     Num<3>             is the Numeral 3
+//     Prim<Op::ADD>      is the Primitive with that Primitive::Op
+//
+// A variable is resolved at compile time to the index of the innermost Lam
+// binding it, or else left as a free Name. A term type used inside another is
+// copied in, so the binders around it capture its free variables.
+//
+//     LAMBDA_VARIABLE(x);
+//     LAMBDA_VARIABLE(y);
+//     constexpr Term<Lam<x, y, x>> select_first{};
+//     ExpressionP e = select_first;
+
+#define LAMBDA_VARIABLE(var) \
+	struct var { static constexpr const char *text = #var; }
+
+template<typename Var, typename... Rest> struct Lam {};
+template<typename Func, typename Arg, typename... Rest> struct App {};
+template<unsigned Value> struct Num {};
+template<Primitive::Op O> struct Prim {};
+
+// One node of a term in postfix order: an abstraction or application follows
+// its body or its function and argument
+struct Cell
+{
+	enum Kind: unsigned char {
+		INDEX,
+		NAME,
+		FUNCTION,
+		APPLICATION,
+		NUMERAL,
+		PRIMITIVE
+	};
+
+	Kind kind;
+	// INDEX, the value of NUMERAL and the op of PRIMITIVE
+	unsigned index;
+	// NAME, and the binder of FUNCTION
+	const char *name;
+};
+
+// The expression for cells, built with the current region set aside since it
+// is kept for the life of the program
+ExpressionP build(const Cell *cells, size_t size);
+
+namespace Detail {
+
+template<Cell::Kind K, unsigned I, typename Var>
+struct C
+{
+	static constexpr Cell::Kind kind = K;
+	static constexpr unsigned index = I;
+	static constexpr const char *name = Var::text;
+};
+
+struct NoName
+{
+	static constexpr const char *text = nullptr;
+};
+
+template<typename... Cs> struct Cells {};
+
+template<typename... Lists> struct Concat;
+
+template<typename... As>
+struct Concat<Cells<As...>>
+{
+	using type = Cells<As...>;
+};
+
+template<typename... As, typename... Bs, typename... Lists>
+struct Concat<Cells<As...>, Cells<Bs...>, Lists...>
+{
+	using type = typename Concat<Cells<As..., Bs...>, Lists...>::type;
+};
+
+// Position of Var among the enclosing binders, innermost first
+template<typename Var, typename... Scope>
+struct IndexOf
+{
+	static constexpr bool found = false;
+	static constexpr unsigned value = 0;
+};
+
+template<typename Var, typename... Scope>
+struct IndexOf<Var, Var, Scope...>
+{
+	static constexpr bool found = true;
+	static constexpr unsigned value = 0;
+};
+
+template<typename Var, typename Other, typename... Scope>
+struct IndexOf<Var, Other, Scope...>
+{
+	static constexpr bool found = IndexOf<Var, Scope...>::found;
+	static constexpr unsigned value = IndexOf<Var, Scope...>::value + 1;
+};
+
+// The cells of T under the binders in Scope
+template<typename T, typename... Scope>
+struct Compile
+{
+	using Found = IndexOf<T, Scope...>;
+	using type = Cells<C<Found::found ? Cell::INDEX : Cell::NAME, Found::value, T>>;
+};
+
+template<typename Var, typename Body, typename... Scope>
+struct Compile<Lam<Var, Body>, Scope...>
+{
+	using type = typename Concat<
+		typename Compile<Body, Var, Scope...>::type,
+		Cells<C<Cell::FUNCTION, 0, Var>>
+	>::type;
+};
+
+template<typename Var, typename Next, typename Body, typename... Rest, typename... Scope>
+struct Compile<Lam<Var, Next, Body, Rest...>, Scope...>:
+	Compile<Lam<Var, Lam<Next, Body, Rest...>>, Scope...> {};
+
+template<typename Func, typename Arg, typename... Scope>
+struct Compile<App<Func, Arg>, Scope...>
+{
+	using type = typename Concat<
+		typename Compile<Func, Scope...>::type,
+		typename Compile<Arg, Scope...>::type,
+		Cells<C<Cell::APPLICATION, 0, NoName>>
+	>::type;
+};
+
+template<typename Func, typename Arg, typename Next, typename... Rest, typename... Scope>
+struct Compile<App<Func, Arg, Next, Rest...>, Scope...>:
+	Compile<App<App<Func, Arg>, Next, Rest...>, Scope...> {};
+
+template<unsigned Value, typename... Scope>
+struct Compile<Num<Value>, Scope...>
+{
+	using type = Cells<C<Cell::NUMERAL, Value, NoName>>;
+};
+
+template<Primitive::Op O, typename... Scope>
+struct Compile<Prim<O>, Scope...>
+{
+	using type = Cells<C<Cell::PRIMITIVE, static_cast<unsigned>(O), NoName>>;
+};
+
+template<typename List> struct Image;
+
+template<typename... Cs>
+struct Image<Cells<Cs...>>
+{
+	static constexpr Cell cells[] = {{Cs::kind, Cs::index, Cs::name}...};
+	static constexpr size_t size = sizeof...(Cs);
+};
+
+template<typename... Cs>
+constexpr Cell Image<Cells<Cs...>>::cells[];
+
+} // namespace Detail
+
+template<typename T>
+struct Term
+{
+	using Image = Detail::Image<typename Detail::Compile<T>::type>;
+
+	operator ExpressionP() const
+	{
+		static const ExpressionP expr = build(Image::cells, Image::size);
+		return expr;
+	}
+};
+
+namespace Detail {
+
+// A Term inside another term stands for the term it wraps
+template<typename T, typename... Scope>
+struct Compile<Term<T>, Scope...>: Compile<T, Scope...> {};
+
+} // namespace Detail
+
+} // namespace Terms
+} // namespace Lambda
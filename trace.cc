@@ -0,0 +1,376 @@
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "budget.h"
+#include "trace.h"
+
+using std::dynamic_pointer_cast;
+using std::ostream;
+using std::ostringstream;
+using std::runtime_error;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+namespace Lambda {
+namespace Trace {
+
+namespace {
+
+thread_local const Scope *t_scope = nullptr;
+
+// Room for a few thousand steps between writes to the file
+const size_t BUFFER_SIZE = 1 << 16;
+
+// Appends to path the way to the step Dreduce1 takes on app, if any
+bool delta(const Application &app, const ExpressionP &expr, Rule &rule, string &path);
+
+// Appends to path the way to the next Nreduce1 step within expr, if any
+bool next(const ExpressionP &expr, Rule &rule, string &path)
+{
+	if (auto app = dynamic_cast<const Application *>(expr.get())) {
+		if (dynamic_cast<const Function *>(app->func().get())) {
+			rule = Rule::BETA;
+			return true;
+		}
+		if (delta(*app, expr, rule, path)) {
+			return true;
+		}
+		path += 'f';
+		if (next(app->func(), rule, path)) {
+			return true;
+		}
+		path.back() = 'a';
+		if (next(app->arg(), rule, path)) {
+			return true;
+		}
+		path.pop_back();
+	} else if (auto func = dynamic_cast<const Function *>(expr.get())) {
+		path += 'b';
+		if (next(func->body(), rule, path)) {
+			return true;
+		}
+		path.pop_back();
+	} else if (dynamic_cast<const Primitive *>(expr.get())) {
+		rule = Rule::DEFINITION;
+		return true;
+	}
+
+	return false;
+}
+
+bool delta(const Application &app, const ExpressionP &expr, Rule &rule, string &path)
+{
+	if (dynamic_cast<const Numeral *>(app.func().get())) {
+		rule = Rule::UNFOLD;
+		return true;
+	}
+
+	auto prim = saturated(*expr);
+	if (!prim) {
+		return false;
+	}
+
+	// The last argument first, as Dreduce1 looks at them
+	vector<ExpressionP> args;
+	for (auto node = &app; node; node = dynamic_cast<const Application *>(node->func().get())) {
+		args.push_back(node->arg());
+	}
+
+	// The primitive itself
+	auto definition = [&]() {
+		path.append(args.size(), 'f');
+		rule = Rule::DEFINITION;
+		return true;
+	};
+
+	vector<unsigned long> values(args.size());
+	for (size_t i = 0; i < args.size(); ++i) {
+		if (auto num = dynamic_cast<const Numeral *>(args[i].get())) {
+			values[args.size() - 1 - i] = num->value();
+			continue;
+		}
+		if (prim->lazy() || weakHeadNormal(*args[i])) {
+			return definition();
+		}
+		path.append(i, 'f');
+		path += 'a';
+		return next(args[i], rule, path);
+	}
+
+	if (prim->overflows(values)) {
+		return definition();
+	}
+	rule = Rule::DELTA;
+	return true;
+}
+
+// The subterm expr rewritten by rule
+ExpressionP contract(const ExpressionP &expr, Rule rule)
+{
+	auto app = dynamic_cast<const Application *>(expr.get());
+	switch (rule) {
+	case Rule::BETA:
+		if (app) {
+			if (auto reduced = app->apply()) {
+				return reduced;
+			}
+		}
+		break;
+	case Rule::UNFOLD:
+		if (app) {
+			if (auto num = dynamic_cast<const Numeral *>(app->func().get())) {
+				return Application::create(num->unfold(), app->arg());
+			}
+		}
+		break;
+	case Rule::DELTA:
+		if (auto prim = saturated(*expr)) {
+			vector<unsigned long> values(prim->arity());
+			auto i = values.size();
+			for (; app; app = dynamic_cast<const Application *>(app->func().get())) {
+				auto num = dynamic_cast<const Numeral *>(app->arg().get());
+				if (!num) {
+					break;
+				}
+				values[--i] = num->value();
+			}
+			if (!app) {
+				if (auto result = prim->apply(values)) {
+					return result;
+				}
+			}
+		}
+		break;
+	case Rule::DEFINITION:
+		if (auto prim = dynamic_cast<const Primitive *>(expr.get())) {
+			return prim->definition();
+		}
+		break;
+	}
+
+	throw runtime_error(string("No ") + ruleName(rule) + " redex there");
+}
+
+ExpressionP rewrite(const ExpressionP &expr, const string &path, size_t at, Rule rule)
+{
+	if (at == path.size()) {
+		return contract(expr, rule);
+	}
+
+	auto app = dynamic_cast<const Application *>(expr.get());
+	auto func = dynamic_cast<const Function *>(expr.get());
+	if (path[at] == 'f' && app) {
+		return Application::create(rewrite(app->func(), path, at + 1, rule), app->arg());
+	} else if (path[at] == 'a' && app) {
+		return Application::create(app->func(), rewrite(app->arg(), path, at + 1, rule));
+	} else if (path[at] == 'b' && func) {
+		return Function::fromIndexed(func->vbound(), rewrite(func->body(), path, at + 1, rule));
+	}
+
+	throw runtime_error("No subterm at path \"" + path + "\"");
+}
+
+void quote(ostream &os, const string &text)
+{
+	os << '"';
+	for (auto c: text) {
+		if (c == '"' || c == '\\') {
+			os << '\\' << c;
+		} else if (static_cast<unsigned char>(c) < 0x20) {
+			os << "\\u00" << "0123456789abcdef"[c >> 4] << "0123456789abcdef"[c & 0xf];
+		} else {
+			os << c;
+		}
+	}
+	os << '"';
+}
+
+// Writes the nodes of expr not in ids yet, after the ones they refer to
+unsigned emit(ostream &os, const ExpressionP &expr, unordered_map<const Expression *, unsigned> &ids)
+{
+	auto found = ids.find(expr.get());
+	if (found != ids.end()) {
+		return found->second;
+	}
+
+	ostringstream node;
+	if (auto name = dynamic_cast<const Name *>(expr.get())) {
+		node << "[\"v\",";
+		quote(node, name->name().str());
+	} else if (auto index = dynamic_cast<const Index *>(expr.get())) {
+		node << "[\"i\"," << index->index();
+	} else if (auto func = dynamic_cast<const Function *>(expr.get())) {
+		auto body = emit(os, func->body(), ids);
+		node << "[\"l\",";
+		quote(node, func->vbound()->name().str());
+		node << "," << body;
+	} else if (auto app = dynamic_cast<const Application *>(expr.get())) {
+		auto f = emit(os, app->func(), ids);
+		auto a = emit(os, app->arg(), ids);
+		node << "[\"a\"," << f << "," << a;
+	} else if (auto num = dynamic_cast<const Numeral *>(expr.get())) {
+		node << "[\"n\"," << num->value();
+	} else {
+		auto prim = static_cast<const Primitive *>(expr.get());
+		node << "[\"p\",\"" << prim->name() << "\"";
+	}
+	node << "]";
+
+	auto id = static_cast<unsigned>(ids.size());
+	os << (id ? "," : "") << node.str();
+	ids.emplace(expr.get(), id);
+	return id;
+}
+
+const char *engineName(Engine engine)
+{
+	switch (engine) {
+	case Engine::APPLICATIVE:
+		return "applicative";
+	case Engine::ZIPPER:
+		return "zipper";
+	default:
+		return "normal";
+	}
+}
+
+} // namespace
+
+const char *ruleName(Rule rule)
+{
+	switch (rule) {
+	case Rule::BETA:
+		return "beta";
+	case Rule::UNFOLD:
+		return "unfold";
+	case Rule::DELTA:
+		return "delta";
+	case Rule::DEFINITION:
+		return "definition";
+	}
+	return "";
+}
+
+bool ruleNamed(const string &name, Rule &rule)
+{
+	for (auto candidate: {Rule::BETA, Rule::UNFOLD, Rule::DELTA, Rule::DEFINITION}) {
+		if (name == ruleName(candidate)) {
+			rule = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool locate(const ExpressionP &expr, bool applicative, Rule &rule, string &path)
+{
+	path.clear();
+	auto app = dynamic_cast<const Application *>(expr.get());
+	if (!applicative || !app) {
+		// Areduce1 only differs at the root
+		return next(expr, rule, path);
+	}
+
+	path = "a";
+	if (next(app->arg(), rule, path)) {
+		return true;
+	}
+	path.clear();
+	if (dynamic_cast<const Function *>(app->func().get())) {
+		rule = Rule::BETA;
+		return true;
+	}
+	if (delta(*app, expr, rule, path)) {
+		return true;
+	}
+	path = "f";
+	if (next(app->func(), rule, path)) {
+		return true;
+	}
+	path.clear();
+	return false;
+}
+
+ExpressionP rewrite(const ExpressionP &expr, const string &path, Rule rule)
+{
+	return rewrite(expr, path, 0, rule);
+}
+
+Writer::Writer(const string &file, unsigned long snapshot_every):
+	m_buffer(BUFFER_SIZE),
+	m_every(snapshot_every),
+	m_evals(0)
+{
+	m_out.rdbuf()->pubsetbuf(m_buffer.data(), m_buffer.size());
+	m_out.open(file);
+}
+
+ExpressionP Writer::normalize(const ExpressionP &expr, Engine engine, const string &source)
+{
+	auto eval = ++m_evals;
+	m_out << "{\"eval\":" << eval << ",\"engine\":\"" << engineName(engine) << "\",\"expression\":";
+	quote(m_out, source);
+	m_out << "}\n";
+
+	auto applicative = engine == Engine::APPLICATIVE;
+	auto term = expr;
+	unsigned long steps = 0;
+	snapshot(0, term);
+
+	Rule rule;
+	string path;
+	try {
+		while (true) {
+			Budget::step();
+			if (!locate(term, applicative, rule, path)) {
+				break;
+			}
+			auto reduced = rewrite(term, path, rule);
+			++steps;
+			m_out << "{\"step\":" << steps << ",\"rule\":\"" << ruleName(rule) << "\",\"path\":\"" << path
+				<< "\",\"delta\":" << static_cast<long long>(reduced->size()) - term->size() << "}\n";
+			term = reduced;
+			if (m_every && steps % m_every == 0) {
+				snapshot(steps, term);
+			}
+		}
+	} catch (const BudgetExceeded &) {
+		m_out << "{\"end\":" << eval << ",\"steps\":" << steps << ",\"status\":\"stopped\"}" << std::endl;
+		throw;
+	}
+
+	m_out << "{\"end\":" << eval << ",\"steps\":" << steps << ",\"status\":\"ok\"}" << std::endl;
+	return term;
+}
+
+void Writer::snapshot(unsigned long step, const ExpressionP &expr)
+{
+	unordered_map<const Expression *, unsigned> ids;
+	m_out << "{\"step\":" << step << ",\"snapshot\":[";
+	emit(m_out, expr, ids);
+	m_out << "]}\n";
+}
+
+Scope::Scope(Writer *writer, const string &source):
+	m_writer(writer),
+	m_source(source),
+	m_previous(t_scope)
+{
+	t_scope = this;
+}
+
+Scope::~Scope()
+{
+	t_scope = m_previous;
+}
+
+const Scope *Scope::current()
+{
+	return t_scope && t_scope->m_writer ? t_scope : nullptr;
+}
+
+} // namespace Trace
+} // namespace Lambda
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "lambda.h"
+
+namespace Lambda {
+namespace Trace {
+
+// The rewrites a step of Nreduce1 or Areduce1 is made of
+enum class Rule {
+	// An abstraction applied to an argument
+	BETA,
+	// An applied numeral replaced by its Church encoding
+	UNFOLD,
+	// A saturated primitive applied to numerals given its result
+	DELTA,
+	// A primitive replaced by its definition
+	DEFINITION
+};
+
+const char *ruleName(Rule rule);
+
+// The rule named name, false if there is none
+bool ruleNamed(const std::string &name, Rule &rule);
+
+// A path leads from the root to a subterm, one letter per node passed: 'f' for
+// the function of an application, 'a' for its argument and 'b' for the body
+// of an abstraction.
+
+// The rule and the path of the next step that Areduce1, if applicative, or
+// Nreduce1 takes on expr, false if it is in normal form. The memo table is not
+// looked at.
+bool locate(const ExpressionP &expr, bool applicative, Rule &rule, std::string &path);
+
+// The subterm at path rewritten by rule, with the rest of expr as it was.
+// Throws runtime_error if there is no such subterm or rule does not apply to
+// it.
+ExpressionP rewrite(const ExpressionP &expr, const std::string &path, Rule rule);
+
+// Writes the reductions of the step engines to a file, one JSON object per
+// line. An evaluation starts with
+//   {"eval":1,"engine":"normal","expression":"..."}
+// then has a record for every step, the rule it applies, where, and how much
+// it changes the size of the term,
+//   {"step":1,"rule":"beta","path":"fab","delta":-3}
+// a snapshot of the whole term every so many steps, and before the first,
+//   {"step":0,"snapshot":[["v","x"],["l","y",0],["a",1,0]]}
+// and ends with
+//   {"end":1,"steps":42,"status":"ok"}
+// or "stopped" when the budget ran out. A snapshot lists every distinct node
+// once, after the nodes it refers to by their position in the list, and the
+// term itself last: ["v",name] is a free variable, ["i",n] a bound one,
+// ["l",name,body] an abstraction, ["a",func,arg] an application, ["n",value]
+// a numeral and ["p",name] a primitive.
+class Writer
+{
+public:
+	// A snapshot every snapshot_every steps, none but the first if zero
+	Writer(const std::string &file, unsigned long snapshot_every);
+
+	Writer(const Writer &) = delete;
+	Writer &operator=(const Writer &) = delete;
+
+	// Opening the file failed
+	bool operator!() const
+	{
+		return !m_out;
+	}
+
+	// The normal form of expr reached by repeated Areduce1 steps for
+	// APPLICATIVE, or Nreduce1 steps otherwise, each of them written down.
+	// Source is the text of the expression.
+	ExpressionP normalize(const ExpressionP &expr, Engine engine, const std::string &source);
+
+private:
+	void snapshot(unsigned long step, const ExpressionP &expr);
+
+	std::vector<char> m_buffer;
+	std::ofstream m_out;
+	const unsigned long m_every;
+	unsigned long m_evals;
+};
+
+// Puts writer in force on this thread for the lifetime of the scope, none if
+// it is null, for the evaluation of the expression written as source
+class Scope
+{
+public:
+	Scope(Writer *writer, const std::string &source);
+	~Scope();
+
+	Scope(const Scope &) = delete;
+	Scope &operator=(const Scope &) = delete;
+
+	ExpressionP normalize(const ExpressionP &expr, Engine engine) const
+	{
+		return m_writer->normalize(expr, engine, m_source);
+	}
+
+	// The scope in force on this thread, if it has a writer
+	static const Scope *current();
+
+private:
+	Writer *const m_writer;
+	const std::string m_source;
+	const Scope *const m_previous;
+};
+
+} // namespace Trace
+} // namespace Lambda
@@ -0,0 +1,522 @@
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "budget.h"
+#include "region.h"
+#include "vm.h"
+
+using std::shared_ptr;
+using std::static_pointer_cast;
+using std::unordered_map;
+using std::vector;
+
+namespace Lambda {
+namespace VM {
+
+namespace {
+
+enum class Op: unsigned char {
+	// Bind the argument on top of the stack, or return the abstraction
+	// starting here if there is none. arg is the constant naming the binder.
+	GRAB,
+	// Push a closure of the block at arg in the current environment
+	ARG,
+	// Push the closure in environment slot arg
+	ARG_VAR,
+	// Continue with the closure in environment slot arg
+	ACCESS,
+	// Stop at the free Name in constant arg
+	NAME,
+	// The Numeral in constant arg: unfold it if it is applied, otherwise it is
+	// a value like an abstraction
+	NUMERAL,
+	// Apply the Primitive in constant arg, or continue with its definition
+	PRIM
+};
+
+struct Instr
+{
+	Op op;
+	unsigned arg;
+};
+
+struct Thunk;
+using ThunkP = shared_ptr<Thunk>;
+
+struct Env;
+using EnvP = shared_ptr<const Env>;
+
+struct Env
+{
+	Env(const ThunkP &value, const EnvP &next):
+		value(value),
+		next(next) {}
+
+	~Env()
+	{
+		releaseMember(value);
+		releaseMember(next);
+	}
+
+	const ThunkP value;
+	const EnvP next;
+};
+
+// A block of code in an environment, updated in place once evaluated: either
+// to the abstraction it reduced to, or to a variable applied to more thunks
+struct Thunk
+{
+	enum class State {
+		DELAYED,
+		FUNCTION,
+		NEUTRAL
+	};
+
+	Thunk(unsigned pc, const EnvP &env, unsigned depth):
+		state(State::DELAYED),
+		pc(pc),
+		env(env),
+		level(0),
+		depth(depth),
+		normalDepth(0) {}
+
+	// The variable of the binder at level
+	explicit Thunk(unsigned level):
+		state(State::NEUTRAL),
+		pc(0),
+		level(level),
+		depth(level + 1),
+		normalDepth(0) {}
+
+	~Thunk()
+	{
+		releaseMember(env);
+		for (auto &arg: args) {
+			releaseMember(arg);
+		}
+	}
+
+	State state;
+
+	// DELAYED and FUNCTION
+	unsigned pc;
+	EnvP env;
+
+	// NEUTRAL: a free Name, or else the variable at level, applied to args
+	ExpressionP name;
+	unsigned level;
+	vector<ThunkP> args;
+
+	// Binders gone under when the thunk was made. A thunk made while running
+	// another's code gets the depth of the run, so it may be read back under
+	// fewer binders than that, as in the lazy engine.
+	const unsigned depth;
+
+	// The normal form once it has been read back, at the least depth it has
+	// been read at
+	ExpressionP normal;
+	unsigned normalDepth;
+};
+
+struct Frame
+{
+	ThunkP thunk;
+	bool update;
+};
+
+// A normal form being read back around the one the machine is working on: an
+// abstraction waiting for its body, a head waiting for its next argument, or a
+// thunk waiting for the normal form to keep
+struct Read
+{
+	enum class Kind {
+		BODY,
+		ARGS,
+		NORMAL
+	};
+
+	Kind kind;
+	// BODY
+	NameP vbound;
+	// ARGS: the head applied to the arguments read back so far, and the rest
+	ExpressionP result;
+	vector<ThunkP> args;
+	size_t next;
+	// NORMAL
+	ThunkP thunk;
+	// ARGS and NORMAL: the binders the result is read back under, and for
+	// NORMAL the fewer it is read at
+	unsigned depth;
+	unsigned at;
+};
+
+EnvP bind(const ThunkP &value, const EnvP &next)
+{
+	return makeShared<Env>(value, next);
+}
+
+const ThunkP &lookup(const Env *env, unsigned index)
+{
+	for (; index > 0; --index) {
+		env = env->next.get();
+	}
+	return env->value;
+}
+
+class Machine
+{
+public:
+	Machine()
+	{
+		// Enters the thunk in the only slot of its environment
+		m_code.push_back(Instr{Op::ACCESS, 0});
+	}
+
+	// Address of the block for term, compiling it on first use
+	unsigned compile(const ExpressionP &term);
+
+	// With whnf set, stops at a weak head normal form and returns null
+	ExpressionP run(unsigned pc, EnvP env, unsigned depth, bool whnf = false);
+
+private:
+	unsigned constant(const ExpressionP &expr);
+	unsigned block(const ExpressionP &term, vector<std::pair<unsigned, ExpressionP>> &pending);
+	void force(const ThunkP &thunk);
+	bool delta(const Primitive &prim, vector<Frame> &stack, unsigned &pc, EnvP &env);
+
+	vector<Instr> m_code;
+	vector<ExpressionP> m_constants;
+	unordered_map<const Expression *, unsigned> m_blocks;
+};
+
+unsigned Machine::constant(const ExpressionP &expr)
+{
+	m_constants.push_back(expr);
+	return m_constants.size() - 1;
+}
+
+unsigned Machine::compile(const ExpressionP &term)
+{
+	// The ARG instructions still to be given the address of their block,
+	// worked through from here rather than by recursion
+	vector<std::pair<unsigned, ExpressionP>> pending;
+	auto entry = block(term, pending);
+	while (!pending.empty()) {
+		auto arg = std::move(pending.back());
+		pending.pop_back();
+		m_code[arg.first].arg = block(arg.second, pending);
+	}
+	return entry;
+}
+
+// Address of the block for term, compiling it on first use but for the
+// arguments in it, which are added to pending
+unsigned Machine::block(const ExpressionP &term, vector<std::pair<unsigned, ExpressionP>> &pending)
+{
+	auto it = m_blocks.find(term.get());
+	if (it != m_blocks.end()) {
+		return it->second;
+	}
+
+	unsigned entry = m_code.size();
+	m_blocks.emplace(term.get(), entry);
+	// Keeps the node, and so the key, alive
+	constant(term);
+
+	auto expr = term;
+	while (expr) {
+		if (auto app = dynamic_cast<const Application *>(expr.get())) {
+			if (auto index = dynamic_cast<const Index *>(app->arg().get())) {
+				m_code.push_back(Instr{Op::ARG_VAR, index->index()});
+			} else {
+				pending.emplace_back(m_code.size(), app->arg());
+				m_code.push_back(Instr{Op::ARG, 0});
+			}
+			expr = app->func();
+		} else if (auto func = dynamic_cast<const Function *>(expr.get())) {
+			m_code.push_back(Instr{Op::GRAB, constant(func->vbound())});
+			expr = func->body();
+		} else if (auto index = dynamic_cast<const Index *>(expr.get())) {
+			m_code.push_back(Instr{Op::ACCESS, index->index()});
+			expr = nullptr;
+		} else if (dynamic_cast<const Numeral *>(expr.get())) {
+			m_code.push_back(Instr{Op::NUMERAL, constant(expr)});
+			expr = nullptr;
+		} else if (dynamic_cast<const Primitive *>(expr.get())) {
+			m_code.push_back(Instr{Op::PRIM, constant(expr)});
+			expr = nullptr;
+		} else {
+			m_code.push_back(Instr{Op::NAME, constant(expr)});
+			expr = nullptr;
+		}
+	}
+
+	return entry;
+}
+
+void Machine::force(const ThunkP &thunk)
+{
+	if (thunk->state == Thunk::State::DELAYED) {
+		run(0, bind(thunk, nullptr), thunk->depth, true);
+	}
+}
+
+// Replaces a primitive applied to the arguments on stack by its result, false
+// if it is short of arguments, one of them is not a numeral or the result
+// overflows
+bool Machine::delta(const Primitive &prim, vector<Frame> &stack, unsigned &pc, EnvP &env)
+{
+	auto arity = prim.arity();
+	if (stack.size() < arity) {
+		return false;
+	}
+	for (unsigned i = 0; i < arity; ++i) {
+		if (stack[stack.size() - 1 - i].update) {
+			return false;
+		}
+	}
+
+	// The last argument is evaluated first
+	vector<unsigned long> values(arity);
+	for (unsigned i = arity; i-- > 0;) {
+		auto thunk = stack[stack.size() - 1 - i].thunk;
+		if (!prim.lazy()) {
+			force(thunk);
+		}
+		if (thunk->state == Thunk::State::NEUTRAL || m_code[thunk->pc].op != Op::NUMERAL) {
+			return false;
+		}
+		values[i] = static_cast<const Numeral &>(*m_constants[m_code[thunk->pc].arg]).value();
+	}
+
+	auto result = prim.apply(values);
+	if (!result) {
+		return false;
+	}
+	stack.resize(stack.size() - arity);
+	pc = compile(result);
+	env = nullptr;
+	return true;
+}
+
+// depth is the number of binders gone under to reach the code at pc. The
+// normal form is read back from a stack of its own rather than by recursion.
+ExpressionP Machine::run(unsigned pc, EnvP env, unsigned depth, bool whnf)
+{
+	vector<Frame> stack;
+	ExpressionP name;
+	unsigned level = 0;
+
+	// Reading back goes on in the same loop: under a binder, or into the
+	// arguments of a variable one at a time, each kept normal form aside
+	vector<Read> reads;
+	ExpressionP result;
+
+#if defined(__GNUC__)
+	// Threaded dispatch: every instruction jumps straight to the next one
+	static const void *const labels[] = {
+		&&op_grab,
+		&&op_arg,
+		&&op_arg_var,
+		&&op_access,
+		&&op_name,
+		&&op_numeral,
+		&&op_prim
+	};
+#define NEXT() goto *labels[static_cast<unsigned>(m_code[pc].op)]
+#else
+#define NEXT() goto dispatch
+dispatch:
+	switch (m_code[pc].op) {
+	case Op::GRAB:
+		goto op_grab;
+	case Op::ARG:
+		goto op_arg;
+	case Op::ARG_VAR:
+		goto op_arg_var;
+	case Op::ACCESS:
+		goto op_access;
+	case Op::NAME:
+		goto op_name;
+	case Op::NUMERAL:
+		goto op_numeral;
+	case Op::PRIM:
+		goto op_prim;
+	}
+#endif
+
+	NEXT();
+
+op_grab:
+	Budget::step();
+	if (stack.empty()) {
+		if (whnf) {
+			return nullptr;
+		}
+		// Goes on with the body under the binder
+		auto vbound = static_pointer_cast<Name>(m_constants[m_code[pc].arg]);
+		reads.push_back(Read{Read::Kind::BODY, vbound, nullptr, {}, 0, nullptr, 0, 0});
+		env = bind(makeShared<Thunk>(depth), env);
+		++depth;
+		++pc;
+	} else if (stack.back().update) {
+		auto &thunk = *stack.back().thunk;
+		thunk.state = Thunk::State::FUNCTION;
+		thunk.pc = pc;
+		thunk.env = env;
+		stack.pop_back();
+	} else {
+		Stats::beta();
+		env = bind(stack.back().thunk, env);
+		stack.pop_back();
+		++pc;
+	}
+	NEXT();
+
+op_arg:
+	stack.push_back(Frame{makeShared<Thunk>(m_code[pc].arg, env, depth), false});
+	++pc;
+	NEXT();
+
+op_arg_var:
+	stack.push_back(Frame{lookup(env.get(), m_code[pc].arg), false});
+	++pc;
+	NEXT();
+
+op_access:
+	Budget::step();
+	{
+		auto thunk = lookup(env.get(), m_code[pc].arg);
+		if (thunk->state == Thunk::State::DELAYED) {
+			stack.push_back(Frame{thunk, true});
+		} else if (thunk->state == Thunk::State::NEUTRAL) {
+			for (auto it = thunk->args.rbegin(); it != thunk->args.rend(); ++it) {
+				stack.push_back(Frame{*it, false});
+			}
+			name = thunk->name;
+			level = thunk->level;
+			goto stuck;
+		}
+		pc = thunk->pc;
+		env = thunk->env;
+	}
+	NEXT();
+
+op_numeral:
+	if (stack.empty()) {
+		if (whnf) {
+			return nullptr;
+		}
+		result = m_constants[m_code[pc].arg];
+		goto done;
+	} else if (stack.back().update) {
+		auto &thunk = *stack.back().thunk;
+		thunk.state = Thunk::State::FUNCTION;
+		thunk.pc = pc;
+		thunk.env = nullptr;
+		stack.pop_back();
+	} else {
+		auto num = m_constants[m_code[pc].arg];
+		pc = compile(static_cast<const Numeral &>(*num).unfold());
+		env = nullptr;
+	}
+	NEXT();
+
+op_prim:
+	{
+		auto prim = m_constants[m_code[pc].arg];
+		auto &op = static_cast<const Primitive &>(*prim);
+		if (!delta(op, stack, pc, env)) {
+			pc = compile(op.definition());
+			env = nullptr;
+		}
+	}
+	NEXT();
+
+op_name:
+	name = m_constants[m_code[pc].arg];
+
+stuck:
+	{
+		// Every thunk being evaluated is the variable applied to the arguments
+		// above it
+		vector<ThunkP> args;
+		while (!stack.empty()) {
+			auto frame = stack.back();
+			stack.pop_back();
+			if (frame.update) {
+				auto &thunk = *frame.thunk;
+				thunk.state = Thunk::State::NEUTRAL;
+				thunk.env = nullptr;
+				thunk.name = name;
+				thunk.level = level;
+				thunk.args = args;
+			} else {
+				args.push_back(frame.thunk);
+			}
+		}
+		if (whnf) {
+			return nullptr;
+		}
+
+		auto head = name ? name : Index::create(depth - 1 - level);
+		reads.push_back(Read{Read::Kind::ARGS, nullptr, head, std::move(args), 0, nullptr, depth, 0});
+	}
+
+next_arg:
+	{
+		auto &read = reads.back();
+		if (read.next == read.args.size()) {
+			result = std::move(read.result);
+			reads.pop_back();
+			goto done;
+		}
+
+		// Indices can only be raised, so a read at a lesser depth than the
+		// one kept reads the thunk back again there
+		auto thunk = read.args[read.next++];
+		auto at = std::min(read.depth, thunk->depth);
+		if (thunk->normal && at >= thunk->normalDepth) {
+			read.result = Application::create(read.result, thunk->normal->shift(read.depth - thunk->normalDepth, 0));
+			goto next_arg;
+		}
+		reads.push_back(Read{Read::Kind::NORMAL, nullptr, nullptr, {}, 0, thunk, read.depth, at});
+		pc = 0;
+		env = bind(thunk, nullptr);
+		depth = at;
+	}
+	NEXT();
+
+#undef NEXT
+
+done:
+	// Puts result where it goes in the normal forms being read back
+	while (!reads.empty()) {
+		auto &read = reads.back();
+		if (read.kind == Read::Kind::BODY) {
+			result = Function::fromIndexed(read.vbound, result);
+		} else if (read.kind == Read::Kind::NORMAL) {
+			read.thunk->normal = result;
+			read.thunk->normalDepth = read.at;
+			result = result->shift(read.depth - read.at, 0);
+		} else {
+			read.result = Application::create(read.result, result);
+			goto next_arg;
+		}
+		reads.pop_back();
+	}
+	return result;
+}
+
+} // namespace
+
+ExpressionP normalize(const ExpressionP expr)
+{
+	Machine machine;
+	auto pc = machine.compile(expr);
+	return machine.run(pc, nullptr, 0);
+}
+
+} // namespace VM
+} // namespace Lambda
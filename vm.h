@@ -0,0 +1,17 @@
+#pragma once
+
+#include "lambda.h"
+
+namespace Lambda {
+namespace VM {
+
+// Normal form of expr, computed by compiling it to bytecode for a lazy
+// Krivine machine and running that. An abstraction and the spine of
+// applications under it are laid out as one flat block of instructions, and
+// each argument gets its own block, compiled once however often the node
+// occurs. Arguments are evaluated on demand and at most once, so the result is
+// the same as repeated Nreduce1.
+ExpressionP normalize(const ExpressionP expr);
+
+} // namespace VM
+} // namespace Lambda
@@ -0,0 +1,118 @@
+#include "zipper.h"
+
+namespace Lambda {
+
+bool Zipper::step()
+{
+	// The head of the applications along the left of the focus and how many
+	// there are, as in Nreduce1
+	const Expression *spine = nullptr;
+	unsigned spineArgs = 0;
+
+	while (true) {
+		if (auto app = dynamic_cast<const Application *>(m_focus.get())) {
+			if (!spine) {
+				spine = head(*m_focus, spineArgs);
+			}
+			ExpressionP reduced;
+			if (auto func = dynamic_cast<const Function *>(app->func().get())) {
+				reduced = func->Breduce(app->arg());
+			} else {
+				reduced = Dreduce1(m_focus, saturated(*spine, spineArgs));
+			}
+			if (reduced) {
+				m_focus = reduced;
+				contracted();
+				return true;
+			}
+			m_path.push_back(Frame{Side::FUNC, app->arg(), nullptr});
+			m_focus = app->func();
+			--spineArgs;
+		} else if (auto func = dynamic_cast<const Function *>(m_focus.get())) {
+			m_path.push_back(Frame{Side::BODY, nullptr, func->vbound()});
+			m_focus = func->body();
+			spine = nullptr;
+		} else if (auto prim = dynamic_cast<const Primitive *>(m_focus.get())) {
+			// Short of arguments
+			m_focus = prim->definition();
+			contracted();
+			return true;
+		} else if (!next()) {
+			return false;
+		} else {
+			spine = nullptr;
+		}
+	}
+}
+
+void Zipper::contracted()
+{
+	// An abstraction or numeral in function position turns its parent into the
+	// next redex, and a primitive the application that gives it its last
+	// argument
+	unsigned up = 0;
+	if (dynamic_cast<const Function *>(m_focus.get()) || dynamic_cast<const Numeral *>(m_focus.get())) {
+		up = 1;
+	} else {
+		unsigned args;
+		if (auto prim = dynamic_cast<const Primitive *>(head(*m_focus, args))) {
+			up = prim->arity() - args;
+		}
+	}
+
+	if (up > m_path.size()) {
+		return;
+	}
+	for (auto it = m_path.rbegin(); it != m_path.rbegin() + up; ++it) {
+		if (it->side != Side::FUNC) {
+			return;
+		}
+	}
+	for (; up > 0; --up) {
+		m_focus = Application::create(m_focus, m_path.back().other);
+		m_path.pop_back();
+	}
+}
+
+bool Zipper::next()
+{
+	while (!m_path.empty()) {
+		auto frame = m_path.back();
+		m_path.pop_back();
+		switch (frame.side) {
+		case Side::FUNC:
+			m_path.push_back(Frame{Side::ARG, m_focus, nullptr});
+			m_focus = frame.other;
+			return true;
+		case Side::ARG:
+			m_focus = Application::create(frame.other, m_focus);
+			break;
+		case Side::BODY:
+			m_focus = Function::fromIndexed(frame.vbound, m_focus);
+			break;
+		}
+	}
+
+	return false;
+}
+
+ExpressionP Zipper::term() const
+{
+	auto result = m_focus;
+	for (auto it = m_path.rbegin(); it != m_path.rend(); ++it) {
+		switch (it->side) {
+		case Side::FUNC:
+			result = Application::create(result, it->other);
+			break;
+		case Side::ARG:
+			result = Application::create(it->other, result);
+			break;
+		case Side::BODY:
+			result = Function::fromIndexed(it->vbound, result);
+			break;
+		}
+	}
+	return result;
+}
+
+} // namespace Lambda
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+
+#include "lambda.h"
+
+namespace Lambda {
+
+// Normal-order reduction one step at a time, taking the same steps as repeated
+// Nreduce1. The zipper keeps its place in the term between steps:
+// everything before the focus is already in normal form, so the next redex is
+// searched for from the focus rather than from the root, and only the path
+// that is left behind gets rebuilt.
+class Zipper
+{
+public:
+	explicit Zipper(const ExpressionP expr):
+		m_focus(expr) {}
+
+	// Contract the next redex, false once the term is in normal form
+	bool step();
+
+	// The whole term as reduced so far
+	ExpressionP term() const;
+
+private:
+	enum class Side {
+		FUNC,
+		ARG,
+		BODY
+	};
+
+	// Where the focus sits in its parent, and the rest of the parent
+	struct Frame
+	{
+		Side side;
+		ExpressionP other;
+		NameP vbound;
+	};
+
+	// Move up to the next subterm that may still hold a redex, false if
+	// there is none
+	bool next();
+
+	// Move up to the application the contraction at the focus has made a
+	// redex, if there is one
+	void contracted();
+
+	ExpressionP m_focus;
+	std::vector<Frame> m_path;
+};
+
+} // namespace Lambda